@@ -1,47 +1,200 @@
 #include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// Largest alphabet build_tree supports; a tree over n symbols has 2n - 1
+// nodes and codes up to n - 1 bits long
+#define HUFFMAN_MAX_SYMBOLS 512
+
+// Bits of lookahead per decode table entry and how many symbols one entry
+// can emit at most
+#define DECODE_TABLE_BITS 11
+#define DECODE_TABLE_SYMBOLS 3
+// Table lookups done per 64-bit refill; DECODE_LOOKUPS * DECODE_TABLE_BITS
+// must stay within the 57 bits a refill guarantees
+#define DECODE_LOOKUPS 4
+#define DECODE_STREAMS 4
+
+#define BENCH_MIN_SECONDS 0.25
+
+// Interleaved sub-tables for the histogram so consecutive equal bytes do not
+// wait on each other's increments; each chunk keeps the 32-bit sub-table
+// counters from overflowing before they are merged into 64-bit totals.
+// histogram_word is unrolled for exactly four tables.
+#define HISTOGRAM_TABLES 4
+#define HISTOGRAM_CHUNK (1 << 30)
+#define READ_BUFFER_SIZE (1 << 20)
+
+// Block container: "HUFB" header, independently coded blocks, then an index
+// of (offset, raw size, packed size) per block and a footer pointing at it
+#define BLOCK_MAGIC 0x42465548
+#define BLOCK_SIZE_DEFAULT (256 << 10)
+#define BLOCK_SIZE_MAX (64 << 20)
+#define BLOCK_BATCH 4
+#define BLOCK_HEADER_SIZE 8
+#define BLOCK_INDEX_ENTRY_SIZE 16
+#define BLOCK_FOOTER_SIZE 16
+#define BLOCK_RAW 0
+#define BLOCK_HUFFMAN 1
+
+// Adaptive mode codes bytes plus two markers: FLUSH pads to a byte boundary
+// so a reader on a pipe can decode everything sent so far, END stops the
+// stream. Codes are rebuilt from decayed counts after FIRST_INTERVAL bytes,
+// then after twice as many each time up to the chosen interval.
+#define ADAPTIVE_MAGIC 0x41465548
+#define ADAPTIVE_FLUSH 256
+#define ADAPTIVE_END 257
+#define ADAPTIVE_SYMBOLS 258
+#define ADAPTIVE_INTERVAL_DEFAULT (64 << 10)
+#define ADAPTIVE_FIRST_INTERVAL 1024
+#define ADAPTIVE_BUFFER_SIZE (64 << 10)
 
-#define PQ_HEAP_MAX_SIZE 52
 typedef struct Node {
-    char c;
-    int freq;
-    struct Node *left;
-    struct Node *right;
-    int ts;
+    int symbol;
+    uint64_t freq;
+    int left;
+    int right;
 } Node;
 
-typedef struct PriorityQueue {
-    Node *heap[PQ_HEAP_MAX_SIZE];
-    int size;
-    int ts;
-} PriorityQueue;
+typedef struct Tree {
+    Node nodes[2 * HUFFMAN_MAX_SYMBOLS - 1];
+    int root;
+} Tree;
 
 typedef struct PrefixStack {
-    char stack[PQ_HEAP_MAX_SIZE];
+    char stack[HUFFMAN_MAX_SYMBOLS];
     int head;
 } PrefixStack;
 
-Node *new_node(char c, int freq);
-void destroy_node(Node *n);
+typedef struct Code {
+    uint64_t bits;
+    int length;
+} Code;
+
+typedef struct DecodeEntry {
+    uint8_t symbols[DECODE_TABLE_SYMBOLS];
+    uint8_t count;
+    uint8_t length;
+    uint8_t first_length;
+    uint16_t node;
+} DecodeEntry;
+
+typedef struct Decoder {
+    // Code trie; 0 is "no child", negative values are leaves holding
+    // -(symbol + 1)
+    int child[2 * HUFFMAN_MAX_SYMBOLS][2];
+    int size;
+    DecodeEntry table[1 << DECODE_TABLE_BITS];
+} Decoder;
+
+typedef struct Block {
+    const uint8_t *raw;
+    size_t raw_size;
+    uint8_t *packed;
+    size_t packed_size;
+    int status;
+} Block;
+
+typedef struct BlockJob {
+    Block *blocks;
+    int count;
+    atomic_int next;
+} BlockJob;
+
+typedef struct AdaptiveModel {
+    uint64_t counts[ADAPTIVE_SYMBOLS];
+    Code codes[ADAPTIVE_SYMBOLS];
+    int max_length;
+    size_t interval;
+    size_t next_interval;
+    size_t until_rebuild;
+} AdaptiveModel;
+
+typedef struct BitWriter {
+    uint8_t buffer[ADAPTIVE_BUFFER_SIZE + 16];
+    size_t size;
+    uint64_t acc;
+    int count;
+} BitWriter;
 
-PriorityQueue *pq_init(void);
-void pq_insert(PriorityQueue *pq, Node *);
-Node *pq_extract(PriorityQueue *pq);
-void pq_destroy(PriorityQueue *pq);
+int build_tree(const uint64_t map[], int symbols, Tree *tree);
+int compare_leaves(const void *a, const void *b);
+void build_prefixes(
+    const Tree *tree, int root, PrefixStack *prefixes, char *map[]
+);
+void histogram(uint64_t counts[], const uint8_t *in, size_t n);
+void build_codes(
+    const Tree *tree, int root, uint64_t bits, int length, Code codes[]
+);
 
-void build_prefixes(Node *root, PrefixStack *prefixes, char *map[]);
-void heapify(PriorityQueue *pq, int root);
-void heapsort(PriorityQueue *pq);
-int check_order(Node *a, Node *b);
+size_t encode(Code codes[], const uint8_t *in, size_t n, uint8_t *out);
+int decoder_init(Decoder *d, Code codes[], int symbols);
+size_t decode_symbol(
+    const Decoder *d, const uint8_t *in, size_t bitpos, size_t bits,
+    int *symbol
+);
+size_t decode_one(
+    const Decoder *d, const uint8_t *in, size_t bitpos, size_t bits,
+    uint8_t *out
+);
+int decode(
+    const Decoder *d, const uint8_t *in, size_t bits, size_t n, uint8_t *out
+);
+int decode_interleaved(
+    const Decoder *d, const uint8_t *in[], const size_t bits[],
+    const size_t n[], uint8_t *out[]
+);
+
+int benchmark(int argc, char *argv[]);
+
+void canonical_codes(const uint8_t lengths[], int symbols, Code codes[]);
+size_t compress_block(const uint8_t *in, size_t n, uint8_t *out);
+int decompress_block(
+    Decoder *d, const uint8_t *in, size_t packed_size, uint8_t *out,
+    size_t raw_size
+);
+void run_workers(BlockJob *job, int threads, void *(*worker)(void *));
+int compress(int argc, char *argv[]);
+int decompress(int argc, char *argv[]);
+
+void adaptive_init(AdaptiveModel *m, size_t interval);
+void adaptive_rebuild(AdaptiveModel *m);
+int adaptive_update(AdaptiveModel *m, int symbol);
+int adaptive(int argc, char *argv[]);
+int adaptive_encode(size_t interval);
+int adaptive_decode(void);
 
 int main(int argc, char *argv[]) {
-    int char_count = 0;
-    int map[256];
+    uint64_t map[256];
     char *prefix_map[256];
+    Tree tree;
+
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        return benchmark(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-c") == 0) {
+        return compress(argc - 2, argv + 2);
+    }
 
-    PriorityQueue *pq = pq_init();
+    if (argc > 1 && strcmp(argv[1], "-d") == 0) {
+        return decompress(argc - 2, argv + 2);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "-a") == 0) {
+        return adaptive(argc - 2, argv + 2);
+    }
 
     for (int i = 0; i < 256; i++) {
         map[i] = 0;
@@ -51,50 +204,36 @@ int main(int argc, char *argv[]) {
         prefix_map[i] = NULL;
     }
 
-    char c = '\0';
-    while ((c = fgetc(stdin)) != '#') {
-        if (isalpha(c)) {
-            map[(int) c]++;
-            char_count++;
+    uint8_t *buffer = malloc(READ_BUFFER_SIZE);
+    size_t read;
+    while ((read = fread(buffer, 1, READ_BUFFER_SIZE, stdin)) > 0) {
+        uint8_t *end = memchr(buffer, '#', read);
+        histogram(map, buffer, end != NULL ? (size_t) (end - buffer) : read);
+        if (end != NULL) {
+            break;
         }
     }
+    free(buffer);
 
     for (int i = 0; i < 256; i++) {
-        if (isalpha((char) i)) {
-            if (map[i]) {
-                #if DEBUG
-                    printf("%c: %d\n", (char) i, map[i]);
-                #endif
-                Node *n = new_node((char) i, map[i]);
-                pq_insert(pq, n);
-            }
+        if (!isalpha((char) i)) {
+            map[i] = 0;
         }
     }
-    
-    while (pq->size > 1) {
-        Node *left = pq_extract(pq);
-        Node *right = pq_extract(pq);
-        #if DEBUG
-            printf("Left: (%c) %.2f\n", left->c, left->freq);
-            printf("Right: (%c) %.2f\n", right->c, right->freq);
-        #endif
-        Node *n = new_node('\0', left->freq + right->freq);
-        n->left = left;
-        n->right = right;
-        pq_insert(pq, n);
+
+    int root = build_tree(map, 256, &tree);
+    if (root < 0) {
+        return 0;
     }
-    Node *n = pq_extract(pq);
 
     PrefixStack *prefixes = malloc(sizeof(PrefixStack));
-    for (int i = 0; i < PQ_HEAP_MAX_SIZE; i++) {
+    for (int i = 0; i < HUFFMAN_MAX_SYMBOLS; i++) {
         prefixes->stack[i] = '\0';
     }
     prefixes->head = -1;
 
-    build_prefixes(n, prefixes, prefix_map);
+    build_prefixes(&tree, root, prefixes, prefix_map);
     free(prefixes);
-    destroy_node(n);
-    pq_destroy(pq);
 
     for (int i = 0; i < 256; i++) {
         if (prefix_map[i] != NULL) {
@@ -104,148 +243,1484 @@ int main(int argc, char *argv[]) {
     }
 }
 
-Node *new_node(char c, int freq) {
-    Node *n = malloc(sizeof(Node));
-    n->c = c;
-    n->freq = freq;
-    n->left = NULL;
-    n->right = NULL;
-    n->ts = 0;
-    return n;
+/**
+ * build_tree(const uint64_t map[], int symbols, Tree *tree)
+ *
+ * Sort the leaves by frequency once, then merge the two smallest of the
+ * sorted leaves and the internal nodes, which are created in frequency order
+ * and so form a second sorted queue. Ties go to the node created first: the
+ * leaves in symbol order, then the internal nodes.
+ *
+ * Returns the root, or -1 if no symbol occurs
+ */
+int build_tree(const uint64_t map[], int symbols, Tree *tree) {
+    Node *nodes = tree->nodes;
+    int leaves = 0;
+
+    for (int i = 0; i < symbols && i < HUFFMAN_MAX_SYMBOLS; i++) {
+        if (map[i]) {
+            #if DEBUG
+                printf("%c: %" PRIu64 "\n", (char) i, map[i]);
+            #endif
+            nodes[leaves].symbol = i;
+            nodes[leaves].freq = map[i];
+            nodes[leaves].left = -1;
+            nodes[leaves].right = -1;
+            leaves++;
+        }
+    }
+
+    if (leaves == 0) {
+        tree->root = -1;
+        return -1;
+    }
+    qsort(nodes, leaves, sizeof(Node), compare_leaves);
+
+    int leaf = 0, internal = leaves, size = leaves;
+    while (size < 2 * leaves - 1) {
+        int pick[2];
+        for (int k = 0; k < 2; k++) {
+            if (
+                leaf < leaves
+                && (internal == size || nodes[leaf].freq <= nodes[internal].freq)
+            ) {
+                pick[k] = leaf++;
+            } else {
+                pick[k] = internal++;
+            }
+        }
+        #if DEBUG
+            printf("Left: (%c) %" PRIu64 "\n", nodes[pick[0]].symbol, nodes[pick[0]].freq);
+            printf("Right: (%c) %" PRIu64 "\n", nodes[pick[1]].symbol, nodes[pick[1]].freq);
+        #endif
+
+        nodes[size].symbol = -1;
+        nodes[size].freq = nodes[pick[0]].freq + nodes[pick[1]].freq;
+        nodes[size].left = pick[0];
+        nodes[size].right = pick[1];
+        size++;
+    }
+
+    tree->root = size - 1;
+    return tree->root;
 }
 
-PriorityQueue *pq_init() {
-    PriorityQueue *pq = malloc(sizeof(PriorityQueue));
-    pq->size = 0;
-    pq->ts = 0;
-    for (int i = 0; i < PQ_HEAP_MAX_SIZE; i++) {
-        pq->heap[i] = NULL;
+int compare_leaves(const void *a, const void *b) {
+    const Node *x = a, *y = b;
+    if (x->freq != y->freq) {
+        return x->freq < y->freq ? -1 : 1;
     }
+    return x->symbol - y->symbol;
+}
 
-    return pq;
+static inline void histogram_word(uint32_t sub[][256], uint64_t w) {
+    sub[0][w & 0xff]++;
+    sub[1][(w >> 8) & 0xff]++;
+    sub[2][(w >> 16) & 0xff]++;
+    sub[3][(w >> 24) & 0xff]++;
+    sub[0][(w >> 32) & 0xff]++;
+    sub[1][(w >> 40) & 0xff]++;
+    sub[2][(w >> 48) & 0xff]++;
+    sub[3][w >> 56]++;
 }
 
-void pq_insert(PriorityQueue *pq, Node *n) {
-    if (pq->size == PQ_HEAP_MAX_SIZE) {
+/**
+ * histogram(uint64_t counts[], const uint8_t *in, size_t n)
+ *
+ * Add the byte frequencies of in to counts. Bytes are loaded eight at a time
+ * and spread over HISTOGRAM_TABLES sub-tables, which are summed at the end
+ * of every chunk.
+ */
+void histogram(uint64_t counts[], const uint8_t *in, size_t n) {
+    uint32_t sub[HISTOGRAM_TABLES][256];
+
+    while (n > 0) {
+        size_t chunk = n < HISTOGRAM_CHUNK ? n : HISTOGRAM_CHUNK, i = 0;
+        memset(sub, 0, sizeof(sub));
+
+        for (; i + 16 <= chunk; i += 16) {
+            uint64_t a, b;
+            memcpy(&a, in + i, sizeof(a));
+            memcpy(&b, in + i + 8, sizeof(b));
+            histogram_word(sub, a);
+            histogram_word(sub, b);
+        }
+
+        for (; i < chunk; i++) {
+            sub[i % HISTOGRAM_TABLES][in[i]]++;
+        }
+
+        for (int c = 0; c < 256; c++) {
+            uint64_t total = 0;
+            for (int t = 0; t < HISTOGRAM_TABLES; t++) {
+                total += sub[t][c];
+            }
+            counts[c] += total;
+        }
+
+        in += chunk;
+        n -= chunk;
+    }
+}
+
+void build_prefixes(
+    const Tree *tree, int root, PrefixStack *prefixes, char *map[]
+) {
+    const Node *n = &tree->nodes[root];
+    if (n->left < 0) {
+        int len = strlen(prefixes->stack);
+        if (len) {
+            map[n->symbol] = (char *) malloc(len + 1);
+            strcpy(map[n->symbol], prefixes->stack);
+        }
         return;
     }
-    n->ts = pq->ts;
-    pq->heap[pq->size] = n;
-    pq->size++;
-    pq->ts++;
-    heapsort(pq);
+
+    prefixes->head++;
+    prefixes->stack[prefixes->head] = '0';
+    build_prefixes(tree, n->left, prefixes, map);
+    prefixes->stack[prefixes->head] = '\0';
+    prefixes->head--;
+
+    prefixes->head++;
+    prefixes->stack[prefixes->head] = '1';
+    build_prefixes(tree, n->right, prefixes, map);
+    prefixes->stack[prefixes->head] = '\0';
+    prefixes->head--;
 }
 
-Node *pq_extract(PriorityQueue *pq) {
-    if (pq->size == 0) {
-        return NULL;
+/**
+ * build_codes(
+ *     const Tree *tree, int root, uint64_t bits, int length, Code codes[]
+ * )
+ *
+ * Flatten the tree into a code per symbol. A tree with a single leaf still
+ * gets a one bit code so it can be written out.
+ */
+void build_codes(
+    const Tree *tree, int root, uint64_t bits, int length, Code codes[]
+) {
+    const Node *n = &tree->nodes[root];
+    if (n->left < 0) {
+        codes[n->symbol].bits = bits;
+        codes[n->symbol].length = length ? length : 1;
+        return;
     }
 
-    Node *n = pq->heap[0];
-    pq->size--;
-    pq->heap[0] = pq->heap[pq->size];
-    pq->heap[pq->size] = NULL;
-    heapify(pq, 0);
-    return n;
+    build_codes(tree, n->left, bits << 1, length + 1, codes);
+    build_codes(tree, n->right, (bits << 1) | 1, length + 1, codes);
 }
 
-void pq_destroy(PriorityQueue *pq) {
-    for (int i = 0; i < PQ_HEAP_MAX_SIZE; i++) {
-        if (pq->heap[i] != NULL) {
-            destroy_node(pq->heap[i]);
+/**
+ * encode(Code codes[], const uint8_t *in, size_t n, uint8_t *out)
+ *
+ * Write the codes for n symbols as an MSB-first bitstream followed by 8 zero
+ * bytes of padding for the decoder's lookahead.
+ *
+ * Returns the number of bytes written, excluding the padding
+ */
+size_t encode(Code codes[], const uint8_t *in, size_t n, uint8_t *out) {
+    uint8_t *o = out;
+    uint64_t acc = 0;
+    int count = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        uint64_t bits = codes[in[i]].bits;
+        int length = codes[in[i]].length;
+        while (length > 0) {
+            int chunk = length > 32 ? 32 : length;
+            length -= chunk;
+            acc = (acc << chunk) | ((bits >> length) & ((1ULL << chunk) - 1));
+            count += chunk;
+            while (count >= 8) {
+                count -= 8;
+                *o++ = (uint8_t) (acc >> count);
+            }
         }
     }
 
-    free(pq);
+    if (count > 0) {
+        *o++ = (uint8_t) (acc << (8 - count));
+    }
+    memset(o, 0, 8);
+    return o - out;
 }
 
-void destroy_node(Node *n) {
-    if (n->left != NULL) {
-        destroy_node(n->left);
+/**
+ * bits_peek(const uint8_t *in, size_t bitpos)
+ *
+ * Branch-free refill: the 64 bits starting at bitpos, of which at least the
+ * top 57 are valid.
+ */
+static inline uint64_t bits_peek(const uint8_t *in, size_t bitpos) {
+    uint64_t window;
+    memcpy(&window, in + (bitpos >> 3), sizeof(window));
+    return __builtin_bswap64(window) << (bitpos & 7);
+}
+
+/**
+ * decoder_init(Decoder *d, Code codes[], int symbols)
+ *
+ * Build the code trie and the multi-symbol lookup table. Each table entry
+ * holds every code that fits completely in its DECODE_TABLE_BITS bits (up to
+ * DECODE_TABLE_SYMBOLS of them); entries whose first code is longer remember
+ * the trie node reached so decoding can continue bit by bit. Symbols past
+ * 255 never go in the table, their entries walk the trie from the root.
+ *
+ * Returns 0 on success and -1 if the codes are not prefix-free
+ */
+int decoder_init(Decoder *d, Code codes[], int symbols) {
+    memset(d->child, 0, sizeof(d->child));
+    d->size = 1;
+
+    for (int c = 0; c < symbols && c < HUFFMAN_MAX_SYMBOLS; c++) {
+        if (codes[c].length == 0) {
+            continue;
+        }
+
+        int node = 0;
+        for (int i = codes[c].length - 1; i >= 0; i--) {
+            int bit = (codes[c].bits >> i) & 1;
+            int next = d->child[node][bit];
+            if (next < 0 || (i == 0 && next != 0)) {
+                return -1;
+            }
+
+            if (i == 0) {
+                d->child[node][bit] = -(c + 1);
+            } else if (next == 0) {
+                if (d->size == 2 * HUFFMAN_MAX_SYMBOLS) {
+                    return -1;
+                }
+                next = d->size++;
+                d->child[node][bit] = next;
+            }
+            node = next;
+        }
     }
-    if (n->right != NULL) {
-        destroy_node(n->right);
+
+    for (int i = 0; i < (1 << DECODE_TABLE_BITS); i++) {
+        DecodeEntry *e = &d->table[i];
+        memset(e, 0, sizeof(DecodeEntry));
+
+        int node = 0, walked = DECODE_TABLE_BITS;
+        for (int pos = 0; pos < DECODE_TABLE_BITS; pos++) {
+            int bit = (i >> (DECODE_TABLE_BITS - 1 - pos)) & 1;
+            int next = d->child[node][bit];
+            if (next == 0) {
+                node = 0;
+                break;
+            }
+
+            if (next > 0) {
+                node = next;
+                continue;
+            }
+
+            if (-next - 1 > 255) {
+                node = 0;
+                walked = 0;
+                break;
+            }
+
+            e->symbols[e->count] = (uint8_t) (-next - 1);
+            e->count++;
+            e->length = pos + 1;
+            if (e->count == 1) {
+                e->first_length = pos + 1;
+            }
+            node = 0;
+            if (e->count == DECODE_TABLE_SYMBOLS) {
+                break;
+            }
+        }
+
+        // Without a symbol, first_length is how far the trie walk already
+        // got; node 0 after a full table's worth of bits is an invalid code
+        if (e->count == 0) {
+            e->node = node;
+            e->first_length = walked;
+        }
     }
-    free(n);
+
+    return 0;
 }
 
-void build_prefixes(Node *root, PrefixStack *prefixes, char *map[]) {
-    if (root->c != '\0') {
-        int len = strlen(prefixes->stack);
-        if (len) {
-            map[(int) root->c] = (char *) malloc(len + 1);
-            strcpy(map[(int) root->c], prefixes->stack);
+/**
+ * decode_symbol(
+ *     const Decoder *d, const uint8_t *in, size_t bitpos, size_t bits,
+ *     int *symbol
+ * )
+ *
+ * Decode a single symbol starting at bitpos, walking the trie past the table
+ * for long codes. Nothing is read from past the first bits bits of in plus
+ * 8 bytes of padding.
+ *
+ * Returns the bit position after the symbol or SIZE_MAX on an invalid code
+ * or one that runs past bits
+ */
+size_t decode_symbol(
+    const Decoder *d, const uint8_t *in, size_t bitpos, size_t bits,
+    int *symbol
+) {
+    if (bitpos >= bits) {
+        return SIZE_MAX;
+    }
+
+    const DecodeEntry *e = &d->table[
+        bits_peek(in, bitpos) >> (64 - DECODE_TABLE_BITS)
+    ];
+    if (e->count) {
+        *symbol = e->symbols[0];
+        bitpos += e->first_length;
+        return bitpos <= bits ? bitpos : SIZE_MAX;
+    }
+
+    int node = e->node;
+    if (node == 0 && e->first_length != 0) {
+        return SIZE_MAX;
+    }
+
+    bitpos += e->first_length;
+    while (1) {
+        if (bitpos >= bits) {
+            return SIZE_MAX;
         }
+        int next = d->child[node][bits_peek(in, bitpos) >> 63];
+        bitpos++;
+        if (next == 0) {
+            return SIZE_MAX;
+        }
+
+        if (next < 0) {
+            *symbol = -next - 1;
+            return bitpos;
+        }
+        node = next;
     }
+}
+
+size_t decode_one(
+    const Decoder *d, const uint8_t *in, size_t bitpos, size_t bits,
+    uint8_t *out
+) {
+    int symbol = 0;
+    bitpos = decode_symbol(d, in, bitpos, bits, &symbol);
+    *out = (uint8_t) symbol;
+    return bitpos;
+}
+
+/**
+ * decode(
+ *     const Decoder *d, const uint8_t *in, size_t bits, size_t n, uint8_t *out
+ * )
+ *
+ * Decode n symbols from a single stream of bits bits.
+ *
+ * Returns 0 on success and -1 on an invalid code or a truncated stream
+ */
+int decode(
+    const Decoder *d, const uint8_t *in, size_t bits, size_t n, uint8_t *out
+) {
+    const size_t round = DECODE_LOOKUPS * DECODE_TABLE_SYMBOLS;
+    size_t bitpos = 0;
+    uint8_t *end = out + n;
+
+    while ((size_t) (end - out) >= round) {
+        // A round moves at most DECODE_LOOKUPS table entries on from here,
+        // all within the window; overrunning shows at the next check
+        if (bitpos >= bits) {
+            return -1;
+        }
+        uint64_t window = bits_peek(in, bitpos);
+        int k = 0;
+        for (; k < DECODE_LOOKUPS; k++) {
+            const DecodeEntry *e = &d->table[
+                window >> (64 - DECODE_TABLE_BITS)
+            ];
+            if (e->count == 0) {
+                break;
+            }
+            memcpy(out, e->symbols, DECODE_TABLE_SYMBOLS);
+            out += e->count;
+            window <<= e->length;
+            bitpos += e->length;
+        }
 
-    if (root->left != NULL) {
-        prefixes->head++;
-        prefixes->stack[prefixes->head] = '0';
-        build_prefixes(root->left, prefixes, map);
-        prefixes->stack[prefixes->head] = '\0';
-        prefixes->head--;
+        if (k < DECODE_LOOKUPS) {
+            bitpos = decode_one(d, in, bitpos, bits, out);
+            if (bitpos == SIZE_MAX) {
+                return -1;
+            }
+            out++;
+        }
     }
-    
-    if (root->right != NULL) {
-        prefixes->head++;
-        prefixes->stack[prefixes->head] = '1';
-        build_prefixes(root->right, prefixes, map);
-        prefixes->stack[prefixes->head] = '\0';
-        prefixes->head--;
+
+    while (out < end) {
+        bitpos = decode_one(d, in, bitpos, bits, out);
+        if (bitpos == SIZE_MAX) {
+            return -1;
+        }
+        out++;
     }
+
+    return bitpos <= bits ? 0 : -1;
 }
 
-void heapify(PriorityQueue *pq, int root) {
-    Node *root_node = pq->heap[root];
-    int child = (root * 2) + 1;
+/**
+ * decode_interleaved(
+ *     const Decoder *d, const uint8_t *in[], const size_t bits[],
+ *     const size_t n[], uint8_t *out[]
+ * )
+ *
+ * Decode DECODE_STREAMS independent streams in lockstep so the table loads
+ * of one stream overlap with the others. Stream s is bits[s] bits long and
+ * needs 8 bytes of readable padding after its data.
+ *
+ * Returns 0 on success and -1 on an invalid code or a truncated stream
+ */
+int decode_interleaved(
+    const Decoder *d, const uint8_t *in[], const size_t bits[],
+    const size_t n[], uint8_t *out[]
+) {
+    const size_t round = DECODE_LOOKUPS * DECODE_TABLE_SYMBOLS;
+    size_t bitpos[DECODE_STREAMS];
+    uint8_t *o[DECODE_STREAMS], *end[DECODE_STREAMS];
+    int active = 0;
+
+    for (int s = 0; s < DECODE_STREAMS; s++) {
+        bitpos[s] = 0;
+        o[s] = out[s];
+        end[s] = out[s] + n[s];
+        if (n[s] >= round) {
+            active++;
+        }
+    }
 
-    Node *child_node = NULL,
-         *sibling = NULL;
-    while (child < pq->size) {
-        child_node = pq->heap[child];
-        if (child + 1 < pq->size) {
-            sibling = pq->heap[child + 1];
-            if (check_order(child_node, sibling) == 1) {
-                child_node = sibling;
-                child += 1;
+    // Every entry writes DECODE_TABLE_SYMBOLS bytes whatever its count, so
+    // only run the fast loop while all streams have room for a full round
+    while (active == DECODE_STREAMS) {
+        for (int s = 0; s < DECODE_STREAMS; s++) {
+            if (bitpos[s] >= bits[s]) {
+                return -1;
             }
-        } else {
-            sibling = NULL;
+            uint64_t window = bits_peek(in[s], bitpos[s]);
+            int k = 0;
+            for (; k < DECODE_LOOKUPS; k++) {
+                const DecodeEntry *e = &d->table[
+                    window >> (64 - DECODE_TABLE_BITS)
+                ];
+                if (e->count == 0) {
+                    break;
+                }
+                memcpy(o[s], e->symbols, DECODE_TABLE_SYMBOLS);
+                o[s] += e->count;
+                window <<= e->length;
+                bitpos[s] += e->length;
+            }
+
+            if (k < DECODE_LOOKUPS) {
+                bitpos[s] = decode_one(d, in[s], bitpos[s], bits[s], o[s]);
+                if (bitpos[s] == SIZE_MAX) {
+                    return -1;
+                }
+                o[s]++;
+            }
+
+            if ((size_t) (end[s] - o[s]) < round) {
+                active--;
+            }
+        }
+    }
+
+    for (int s = 0; s < DECODE_STREAMS; s++) {
+        while (o[s] < end[s]) {
+            bitpos[s] = decode_one(d, in[s], bitpos[s], bits[s], o[s]);
+            if (bitpos[s] == SIZE_MAX) {
+                return -1;
+            }
+            o[s]++;
+        }
+        if (bitpos[s] > bits[s]) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * tree_decode(const Tree *tree, const uint8_t *in, size_t n, uint8_t *out)
+ *
+ * Reference decoder walking the tree one bit at a time.
+ */
+void tree_decode(const Tree *tree, const uint8_t *in, size_t n, uint8_t *out) {
+    size_t bitpos = 0;
+    for (size_t i = 0; i < n; i++) {
+        const Node *node = &tree->nodes[tree->root];
+        do {
+            int bit = (in[bitpos >> 3] >> (7 - (bitpos & 7))) & 1;
+            bitpos++;
+            if (node->left >= 0) {
+                node = &tree->nodes[bit ? node->right : node->left];
+            }
+        } while (node->left >= 0);
+        out[i] = (uint8_t) node->symbol;
+    }
+}
+
+/**
+ * bench_run(const char *name, const uint8_t *symbols, size_t n)
+ *
+ * Encode the symbols once and report the decode throughput of the tree
+ * walk, the single stream table decoder and the interleaved table decoder.
+ */
+void bench_run(const char *name, const uint8_t *symbols, size_t n) {
+    uint64_t map[256];
+    Code codes[256];
+    for (int i = 0; i < 256; i++) {
+        map[i] = 0;
+        codes[i].bits = 0;
+        codes[i].length = 0;
+    }
+
+    int reps = 0;
+    double start = bench_now(), histogram_elapsed = 0;
+    do {
+        for (int i = 0; i < 256; i++) {
+            map[i] = 0;
+        }
+        histogram(map, symbols, n);
+        reps++;
+    } while ((histogram_elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+    double histogram_rate = (double) n * reps / histogram_elapsed / 1e6;
+
+    Tree *tree = malloc(sizeof(Tree));
+    if (build_tree(map, 256, tree) < 0) {
+        printf("%s: no symbols\n", name);
+        free(tree);
+        return;
+    }
+    build_codes(tree, tree->root, 0, 0, codes);
+
+    size_t max_bytes = 16;
+    for (int i = 0; i < 256; i++) {
+        if (codes[i].length > 0) {
+            max_bytes += ((size_t) map[i] * codes[i].length + 7) / 8 + 1;
+        }
+    }
+
+    uint8_t *single = malloc(max_bytes);
+    uint8_t *streams = malloc(max_bytes + DECODE_STREAMS * 16);
+    uint8_t *decoded = malloc(n + DECODE_TABLE_SYMBOLS);
+    Decoder *d = malloc(sizeof(Decoder));
+
+    size_t single_size = encode(codes, symbols, n, single);
+
+    const uint8_t *in[DECODE_STREAMS];
+    size_t bits[DECODE_STREAMS], counts[DECODE_STREAMS];
+    uint8_t *out[DECODE_STREAMS];
+    size_t offset = 0, written = 0;
+    for (int s = 0; s < DECODE_STREAMS; s++) {
+        counts[s] = n / DECODE_STREAMS + (s < (int) (n % DECODE_STREAMS));
+        in[s] = streams + written;
+        out[s] = decoded + offset;
+        bits[s] = 8 * encode(
+            codes, symbols + offset, counts[s], streams + written
+        );
+        written += bits[s] / 8 + 8;
+        offset += counts[s];
+    }
+
+    if (decoder_init(d, codes, 256) != 0) {
+        printf("%s: invalid code table\n", name);
+        goto cleanup;
+    }
+
+    const char *labels[3] = { "tree", "table", "interleaved" };
+    double rates[3];
+    for (int method = 0; method < 3; method++) {
+        int reps = 0;
+        memset(decoded, 0, n);
+        double start = bench_now(), elapsed = 0;
+        do {
+            if (method == 0) {
+                tree_decode(tree, single, n, decoded);
+            } else if (method == 1) {
+                decode(d, single, 8 * single_size, n, decoded);
+            } else {
+                decode_interleaved(d, in, bits, counts, out);
+            }
+            reps++;
+        } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+
+        if (memcmp(decoded, symbols, n) != 0) {
+            printf("%s: %s decoder output mismatch\n", name, labels[method]);
+            goto cleanup;
+        }
+        rates[method] = (double) n * reps / elapsed / 1e6;
+    }
+
+    printf(
+        "%s: %zu symbols, %.3f bits/symbol, histogram %.1f MB/s, "
+        "%s %.1f MB/s, %s %.1f MB/s, %s %.1f MB/s\n",
+        name, n, n ? single_size * 8.0 / n : 0.0, histogram_rate,
+        labels[0], rates[0], labels[1], rates[1], labels[2], rates[2]
+    );
+
+cleanup:
+    free(single);
+    free(streams);
+    free(decoded);
+    free(d);
+    free(tree);
+}
+
+/**
+ * benchmark(int argc, char *argv[])
+ *
+ * huffman -b [-n MiB] [file ...]
+ *
+ * Decode throughput over the letters of each input file (up to the '#'
+ * terminator, like the code table mode) and over MiB megabytes of
+ * Zipf-distributed synthetic letters.
+ */
+int benchmark(int argc, char *argv[]) {
+    size_t synthetic = 0;
+    int files = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-n") == 0 && i + 1 < argc) {
+            synthetic = strtoul(argv[++i], NULL, 10) << 20;
+            continue;
+        }
+
+        FILE *f = fopen(argv[i], "rb");
+        if (f == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        files++;
+
+        size_t capacity = 1 << 16, n = 0;
+        uint8_t *symbols = malloc(capacity);
+        int c;
+        while ((c = fgetc(f)) != EOF && c != '#') {
+            if (isalpha(c)) {
+                if (n == capacity) {
+                    capacity *= 2;
+                    symbols = realloc(symbols, capacity);
+                }
+                symbols[n++] = (uint8_t) c;
+            }
+        }
+        fclose(f);
+
+        bench_run(argv[i], symbols, n);
+        free(symbols);
+    }
+
+    if (synthetic == 0 && files == 0) {
+        synthetic = 64 << 20;
+    }
+
+    if (synthetic > 0) {
+        const char *letters =
+            "etaoinshrdlcumwfgypbvkjxqzETAOINSHRDLCUMWFGYPBVKJXQZ";
+        uint8_t lookup[4096];
+        double total = 0, cumulative = 0;
+        for (int r = 0; r < 52; r++) {
+            total += 1.0 / (r + 1);
+        }
+
+        int filled = 0;
+        for (int r = 0; r < 52; r++) {
+            cumulative += 1.0 / (r + 1);
+            int upto = r == 51 ? 4096 : (int) (cumulative / total * 4096);
+            while (filled < upto) {
+                lookup[filled++] = (uint8_t) letters[r];
+            }
+        }
+
+        uint8_t *symbols = malloc(synthetic);
+        uint64_t state = 0x9E3779B97F4A7C15ULL;
+        for (size_t i = 0; i < synthetic; i++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            symbols[i] = lookup[state >> 52];
+        }
+
+        char name[64];
+        snprintf(name, sizeof(name), "synthetic %zu MiB", synthetic >> 20);
+        bench_run(name, symbols, synthetic);
+        free(symbols);
+    }
+
+    return 0;
+}
+
+static void put_u32(uint8_t *p, uint32_t v) {
+    for (int i = 0; i < 4; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+static void put_u64(uint8_t *p, uint64_t v) {
+    for (int i = 0; i < 8; i++) {
+        p[i] = (uint8_t) (v >> (8 * i));
+    }
+}
+
+static uint32_t get_u32(const uint8_t *p) {
+    uint32_t v = 0;
+    for (int i = 3; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t *p) {
+    uint64_t v = 0;
+    for (int i = 7; i >= 0; i--) {
+        v = (v << 8) | p[i];
+    }
+    return v;
+}
+
+/**
+ * canonical_codes(const uint8_t lengths[], int symbols, Code codes[])
+ *
+ * Assign canonical codes from code lengths so a block only has to store one
+ * length byte per symbol.
+ */
+void canonical_codes(const uint8_t lengths[], int symbols, Code codes[]) {
+    int count[65];
+    uint64_t next[65];
+    for (int i = 0; i <= 64; i++) {
+        count[i] = 0;
+    }
+
+    for (int c = 0; c < symbols; c++) {
+        count[lengths[c]]++;
+    }
+
+    uint64_t code = 0;
+    count[0] = 0;
+    for (int i = 1; i <= 64; i++) {
+        code = (code + count[i - 1]) << 1;
+        next[i] = code;
+    }
+
+    for (int c = 0; c < symbols; c++) {
+        codes[c].length = lengths[c];
+        codes[c].bits = lengths[c] ? next[lengths[c]]++ : 0;
+    }
+}
+
+/**
+ * compress_block(const uint8_t *in, size_t n, uint8_t *out)
+ *
+ * Code one block with its own table. A Huffman block is the mode byte, 256
+ * code lengths, the byte size of each of the DECODE_STREAMS streams and the
+ * streams themselves; blocks that would not shrink are stored raw. out needs
+ * room for n + 1 + 256 + 4 * DECODE_STREAMS + 8 bytes.
+ *
+ * Returns the packed size
+ */
+size_t compress_block(const uint8_t *in, size_t n, uint8_t *out) {
+    uint64_t map[256];
+    uint8_t lengths[256];
+    Code codes[256];
+    for (int i = 0; i < 256; i++) {
+        map[i] = 0;
+        lengths[i] = 0;
+        codes[i].length = 0;
+    }
+
+    histogram(map, in, n);
+
+    Tree tree;
+    int root = build_tree(map, 256, &tree);
+    size_t header = 1 + 256 + 4 * DECODE_STREAMS, bits = 0;
+    if (root >= 0) {
+        build_codes(&tree, root, 0, 0, codes);
+        for (int c = 0; c < 256; c++) {
+            lengths[c] = (uint8_t) codes[c].length;
+            bits += (size_t) map[c] * codes[c].length;
         }
+    }
+
+    if (root < 0 || header + bits / 8 + DECODE_STREAMS >= n) {
+        out[0] = BLOCK_RAW;
+        memcpy(out + 1, in, n);
+        return n + 1;
+    }
+
+    canonical_codes(lengths, 256, codes);
+    out[0] = BLOCK_HUFFMAN;
+    memcpy(out + 1, lengths, 256);
 
-        if (check_order(root_node, child_node) == 1) {
-            pq->heap[root] = child_node;
-            root = child;
-            child = (root * 2) + 1;
+    size_t offset = 0, written = header;
+    for (int s = 0; s < DECODE_STREAMS; s++) {
+        size_t count = n / DECODE_STREAMS + (s < (int) (n % DECODE_STREAMS));
+        size_t size = encode(codes, in + offset, count, out + written);
+        put_u32(out + 1 + 256 + 4 * s, (uint32_t) size);
+        offset += count;
+        written += size;
+    }
+
+    return written;
+}
+
+/**
+ * decompress_block(
+ *     Decoder *d, const uint8_t *in, size_t packed_size, uint8_t *out,
+ *     size_t raw_size
+ * )
+ *
+ * Inverse of compress_block. The decoder looks up to 8 bytes past the last
+ * stream, which in an archive always lands in the index or footer.
+ *
+ * Returns 0 on success and -1 on a corrupt block
+ */
+int decompress_block(
+    Decoder *d, const uint8_t *in, size_t packed_size, uint8_t *out,
+    size_t raw_size
+) {
+    if (packed_size < 1) {
+        return -1;
+    }
+
+    if (in[0] == BLOCK_RAW) {
+        if (packed_size != raw_size + 1) {
+            return -1;
+        }
+        memcpy(out, in + 1, raw_size);
+        return 0;
+    }
+
+    size_t header = 1 + 256 + 4 * DECODE_STREAMS;
+    if (in[0] != BLOCK_HUFFMAN || packed_size < header) {
+        return -1;
+    }
+
+    Code codes[256];
+    for (int c = 0; c < 256; c++) {
+        if (in[1 + c] > 64) {
+            return -1;
+        }
+    }
+    canonical_codes(in + 1, 256, codes);
+    if (decoder_init(d, codes, 256) != 0) {
+        return -1;
+    }
+
+    const uint8_t *streams[DECODE_STREAMS];
+    size_t bits[DECODE_STREAMS], counts[DECODE_STREAMS];
+    uint8_t *outs[DECODE_STREAMS];
+    size_t offset = header, written = 0;
+    for (int s = 0; s < DECODE_STREAMS; s++) {
+        size_t size = get_u32(in + 1 + 256 + 4 * s);
+        if (size > packed_size - offset) {
+            return -1;
+        }
+        streams[s] = in + offset;
+        bits[s] = 8 * size;
+        counts[s] = raw_size / DECODE_STREAMS
+            + (s < (int) (raw_size % DECODE_STREAMS));
+        outs[s] = out + written;
+        offset += size;
+        written += counts[s];
+    }
+
+    return decode_interleaved(d, streams, bits, counts, outs);
+}
+
+void *compress_worker(void *arg) {
+    BlockJob *job = arg;
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        Block *b = &job->blocks[i];
+        b->packed_size = compress_block(b->raw, b->raw_size, b->packed);
+        b->status = 0;
+    }
+    return NULL;
+}
+
+void *decompress_worker(void *arg) {
+    BlockJob *job = arg;
+    Decoder *d = malloc(sizeof(Decoder));
+    int i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        Block *b = &job->blocks[i];
+        b->status = decompress_block(
+            d, b->raw, b->packed_size, b->packed, b->raw_size
+        );
+    }
+    free(d);
+    return NULL;
+}
+
+void run_workers(BlockJob *job, int threads, void *(*worker)(void *)) {
+    pthread_t tids[threads];
+    atomic_store(&job->next, 0);
+    if (threads > job->count) {
+        threads = job->count;
+    }
+
+    for (int t = 1; t < threads; t++) {
+        pthread_create(&tids[t], NULL, worker, job);
+    }
+    worker(job);
+    for (int t = 1; t < threads; t++) {
+        pthread_join(tids[t], NULL);
+    }
+}
+
+int parse_threads(const char *s) {
+    int threads = atoi(s);
+    return threads > 0 ? threads : 1;
+}
+
+/**
+ * compress(int argc, char *argv[])
+ *
+ * huffman -c [-t threads] [-s KiB] < input > archive
+ *
+ * Split stdin into blocks and code BLOCK_BATCH blocks per thread at a time,
+ * writing them out in order as each batch finishes.
+ */
+int compress(int argc, char *argv[]) {
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    size_t block_size = BLOCK_SIZE_DEFAULT;
+
+    for (int i = 0; i + 1 < argc; i += 2) {
+        if (strcmp(argv[i], "-t") == 0) {
+            threads = parse_threads(argv[i + 1]);
+        } else if (strcmp(argv[i], "-s") == 0) {
+            block_size = strtoul(argv[i + 1], NULL, 10) << 10;
+        }
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    if (block_size == 0 || block_size > BLOCK_SIZE_MAX) {
+        fprintf(stderr, "block size must be 1 to %d KiB\n", BLOCK_SIZE_MAX >> 10);
+        return 1;
+    }
+
+    int batch = threads * BLOCK_BATCH;
+    size_t slot = block_size + 1 + 256 + 4 * DECODE_STREAMS + 8;
+    uint8_t *in = malloc(block_size * batch);
+    uint8_t *out = malloc(slot * batch);
+    Block *blocks = malloc(sizeof(Block) * batch);
+    BlockJob job = { blocks, 0, 0 };
+
+    size_t index_capacity = 64, num_blocks = 0;
+    uint8_t *index = malloc(index_capacity * BLOCK_INDEX_ENTRY_SIZE);
+
+    uint8_t header[BLOCK_HEADER_SIZE];
+    put_u32(header, BLOCK_MAGIC);
+    put_u32(header + 4, (uint32_t) block_size);
+    fwrite(header, 1, BLOCK_HEADER_SIZE, stdout);
+    uint64_t offset = BLOCK_HEADER_SIZE;
+
+    size_t n;
+    while ((n = fread(in, 1, block_size * batch, stdin)) > 0) {
+        job.count = 0;
+        for (size_t start = 0; start < n; start += block_size) {
+            Block *b = &blocks[job.count];
+            b->raw = in + start;
+            b->raw_size = n - start < block_size ? n - start : block_size;
+            b->packed = out + slot * job.count;
+            job.count++;
+        }
+
+        run_workers(&job, threads, compress_worker);
+
+        for (int i = 0; i < job.count; i++) {
+            if (num_blocks == index_capacity) {
+                index_capacity *= 2;
+                index = realloc(index, index_capacity * BLOCK_INDEX_ENTRY_SIZE);
+            }
+            uint8_t *entry = index + num_blocks * BLOCK_INDEX_ENTRY_SIZE;
+            put_u64(entry, offset);
+            put_u32(entry + 8, (uint32_t) blocks[i].raw_size);
+            put_u32(entry + 12, (uint32_t) blocks[i].packed_size);
+            fwrite(blocks[i].packed, 1, blocks[i].packed_size, stdout);
+            offset += blocks[i].packed_size;
+            num_blocks++;
+        }
+    }
+
+    uint8_t footer[BLOCK_FOOTER_SIZE];
+    put_u64(footer, offset);
+    put_u32(footer + 8, (uint32_t) num_blocks);
+    put_u32(footer + 12, BLOCK_MAGIC);
+    fwrite(index, BLOCK_INDEX_ENTRY_SIZE, num_blocks, stdout);
+    fwrite(footer, 1, BLOCK_FOOTER_SIZE, stdout);
+
+    free(in);
+    free(out);
+    free(blocks);
+    free(index);
+    return fflush(stdout) == 0 ? 0 : 1;
+}
+
+/**
+ * decompress(int argc, char *argv[])
+ *
+ * huffman -d [-t threads] [-r first count] archive > output
+ *
+ * Map the archive and decode its blocks in parallel batches, or only the
+ * count blocks starting at first.
+ */
+int decompress(int argc, char *argv[]) {
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    long first = 0, count = -1;
+    const char *path = NULL;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = parse_threads(argv[++i]);
+        } else if (strcmp(argv[i], "-r") == 0 && i + 2 < argc) {
+            first = atol(argv[++i]);
+            count = atol(argv[++i]);
         } else {
+            path = argv[i];
+        }
+    }
+
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    if (path == NULL) {
+        fprintf(stderr, "usage: huffman -d [-t threads] [-r first count] archive\n");
+        return 1;
+    }
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(path);
+        return 1;
+    }
+
+    size_t size = st.st_size;
+    if (size < BLOCK_HEADER_SIZE + BLOCK_FOOTER_SIZE) {
+        fprintf(stderr, "%s: not a block archive\n", path);
+        close(fd);
+        return 1;
+    }
+
+    const uint8_t *archive = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (archive == MAP_FAILED) {
+        perror(path);
+        return 1;
+    }
+
+    const uint8_t *footer = archive + size - BLOCK_FOOTER_SIZE;
+    uint64_t index_offset = get_u64(footer);
+    size_t num_blocks = get_u32(footer + 8);
+    size_t block_size = get_u32(archive + 4);
+    if (
+        get_u32(archive) != BLOCK_MAGIC || get_u32(footer + 12) != BLOCK_MAGIC
+        || index_offset + num_blocks * BLOCK_INDEX_ENTRY_SIZE
+            != size - BLOCK_FOOTER_SIZE
+    ) {
+        fprintf(stderr, "%s: not a block archive\n", path);
+        munmap((void *) archive, size);
+        return 1;
+    }
+
+    const uint8_t *index = archive + index_offset;
+    if (count < 0 || first < 0 || (size_t) (first + count) > num_blocks) {
+        if (count >= 0) {
+            fprintf(stderr, "%s: has %zu blocks\n", path, num_blocks);
+            munmap((void *) archive, size);
+            return 1;
+        }
+        first = 0;
+        count = num_blocks;
+    }
+
+    int batch = threads * BLOCK_BATCH, status = 0;
+    uint8_t *out = malloc(block_size * batch);
+    Block *blocks = malloc(sizeof(Block) * batch);
+    BlockJob job = { blocks, 0, 0 };
+
+    for (long i = first; i < first + count && status == 0; i += batch) {
+        job.count = 0;
+        for (long j = i; j < first + count && job.count < batch; j++) {
+            const uint8_t *entry = index + j * BLOCK_INDEX_ENTRY_SIZE;
+            Block *b = &blocks[job.count];
+            uint64_t offset = get_u64(entry);
+            b->raw_size = get_u32(entry + 8);
+            b->packed_size = get_u32(entry + 12);
+            b->raw = archive + offset;
+            b->packed = out + block_size * job.count;
+            if (
+                b->raw_size > block_size
+                || offset + b->packed_size > index_offset
+            ) {
+                status = -1;
+                break;
+            }
+            job.count++;
+        }
+
+        if (status != 0) {
             break;
         }
+        run_workers(&job, threads, decompress_worker);
+
+        for (int j = 0; j < job.count && status == 0; j++) {
+            status = blocks[j].status;
+            if (status == 0) {
+                fwrite(blocks[j].packed, 1, blocks[j].raw_size, stdout);
+            }
+        }
+    }
+
+    if (status != 0) {
+        fprintf(stderr, "%s: corrupt block\n", path);
     }
-    pq->heap[root] = root_node;
+
+    free(out);
+    free(blocks);
+    munmap((void *) archive, size);
+    return status == 0 && fflush(stdout) == 0 ? 0 : 1;
 }
 
-void heapsort(PriorityQueue *pq) {
-    for (int i = (pq->size - 1) / 2; i >= 0; --i) {
-        heapify(pq, i);
+void adaptive_init(AdaptiveModel *m, size_t interval) {
+    for (int c = 0; c < ADAPTIVE_SYMBOLS; c++) {
+        m->counts[c] = 1;
     }
+    m->interval = interval;
+    m->next_interval = ADAPTIVE_FIRST_INTERVAL;
+    adaptive_rebuild(m);
 }
 
 /**
- * check_order(Node *a, Node *b)
- * 
- * Compare two nodes and determine which should be a root node when in an
- * almost heap
- * 
- * Returns 1 if b should be root and -1 if a should be root
+ * adaptive_rebuild(AdaptiveModel *m)
+ *
+ * Recompute the codes from the current counts, then halve the counts so old
+ * input fades out and the code lengths stay bounded.
  */
-int check_order(Node *a, Node *b) {
-    if (b->freq < a->freq) {
-        return 1;
+void adaptive_rebuild(AdaptiveModel *m) {
+    Tree tree;
+    Code codes[ADAPTIVE_SYMBOLS];
+    uint8_t lengths[ADAPTIVE_SYMBOLS];
+    for (int c = 0; c < ADAPTIVE_SYMBOLS; c++) {
+        codes[c].length = 0;
+    }
+
+    build_codes(&tree, build_tree(m->counts, ADAPTIVE_SYMBOLS, &tree), 0, 0, codes);
+    m->max_length = 0;
+    for (int c = 0; c < ADAPTIVE_SYMBOLS; c++) {
+        lengths[c] = (uint8_t) codes[c].length;
+        if (codes[c].length > m->max_length) {
+            m->max_length = codes[c].length;
+        }
+        m->counts[c] = (m->counts[c] + 1) / 2;
+    }
+    canonical_codes(lengths, ADAPTIVE_SYMBOLS, m->codes);
+
+    m->until_rebuild = m->next_interval < m->interval
+        ? m->next_interval : m->interval;
+    m->next_interval *= 2;
+}
+
+/**
+ * adaptive_update(AdaptiveModel *m, int symbol)
+ *
+ * Count a coded byte, rebuilding the codes when the interval is up.
+ *
+ * Returns 1 if the codes changed
+ */
+int adaptive_update(AdaptiveModel *m, int symbol) {
+    m->counts[symbol]++;
+    if (--m->until_rebuild > 0) {
+        return 0;
     }
+    adaptive_rebuild(m);
+    return 1;
+}
 
-    if (b->freq == a->freq && b->ts < a->ts) {
+static int write_all(const uint8_t *buffer, size_t n) {
+    while (n > 0) {
+        ssize_t written = write(STDOUT_FILENO, buffer, n);
+        if (written < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -1;
+        }
+        buffer += written;
+        n -= written;
+    }
+    return 0;
+}
+
+static void writer_put(BitWriter *w, Code code) {
+    int length = code.length;
+    while (length > 0) {
+        int chunk = length > 32 ? 32 : length;
+        length -= chunk;
+        w->acc = (w->acc << chunk)
+            | ((code.bits >> length) & ((1ULL << chunk) - 1));
+        w->count += chunk;
+        while (w->count >= 8) {
+            w->count -= 8;
+            w->buffer[w->size++] = (uint8_t) (w->acc >> w->count);
+        }
+    }
+}
+
+static int writer_flush(BitWriter *w, int align) {
+    if (align && w->count > 0) {
+        w->buffer[w->size++] = (uint8_t) (w->acc << (8 - w->count));
+        w->count = 0;
+    }
+    int status = write_all(w->buffer, w->size);
+    w->size = 0;
+    return status;
+}
+
+/**
+ * adaptive(int argc, char *argv[])
+ *
+ * huffman -a [-d] [-s KiB] < input > output
+ *
+ * Single pass coding for unbounded streams: codes adapt to the input every
+ * interval (64 KiB by default) and both sides track the same counts, so no
+ * table is ever sent.
+ */
+int adaptive(int argc, char *argv[]) {
+    size_t interval = ADAPTIVE_INTERVAL_DEFAULT;
+    int decoding = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-d") == 0) {
+            decoding = 1;
+        } else if (strcmp(argv[i], "-s") == 0 && i + 1 < argc) {
+            interval = strtoul(argv[++i], NULL, 10) << 10;
+        }
+    }
+
+    if (interval == 0 || interval > BLOCK_SIZE_MAX) {
+        fprintf(stderr, "interval must be 1 to %d KiB\n", BLOCK_SIZE_MAX >> 10);
         return 1;
     }
 
-    return -1;
+    return decoding ? adaptive_decode() : adaptive_encode(interval);
+}
+
+/**
+ * adaptive_encode(size_t interval)
+ *
+ * Code stdin as it arrives. Whenever a read comes back short the writer
+ * emits FLUSH and hands every byte so far to stdout, so a slow producer's
+ * data reaches the decoder without waiting for a full buffer.
+ */
+int adaptive_encode(size_t interval) {
+    AdaptiveModel *m = malloc(sizeof(AdaptiveModel));
+    BitWriter *w = malloc(sizeof(BitWriter));
+    uint8_t *in = malloc(ADAPTIVE_BUFFER_SIZE);
+    int status = 0;
+
+    adaptive_init(m, interval);
+    put_u32(w->buffer, ADAPTIVE_MAGIC);
+    put_u32(w->buffer + 4, (uint32_t) interval);
+    w->size = 8;
+    w->acc = 0;
+    w->count = 0;
+
+    while (status == 0) {
+        ssize_t n = read(STDIN_FILENO, in, ADAPTIVE_BUFFER_SIZE);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+
+        if (n <= 0) {
+            status = n < 0 ? -1 : 0;
+            break;
+        }
+
+        for (ssize_t i = 0; i < n && status == 0; i++) {
+            writer_put(w, m->codes[in[i]]);
+            adaptive_update(m, in[i]);
+            if (w->size >= ADAPTIVE_BUFFER_SIZE) {
+                status = writer_flush(w, 0);
+            }
+        }
+
+        if (status == 0 && n < ADAPTIVE_BUFFER_SIZE) {
+            writer_put(w, m->codes[ADAPTIVE_FLUSH]);
+            status = writer_flush(w, 1);
+        }
+    }
+
+    if (status == 0) {
+        writer_put(w, m->codes[ADAPTIVE_END]);
+        status = writer_flush(w, 1);
+    }
+
+    if (status != 0) {
+        perror("huffman");
+    }
+
+    free(m);
+    free(w);
+    free(in);
+    return status == 0 ? 0 : 1;
+}
+
+/**
+ * adaptive_fill(uint8_t *in, size_t *end, size_t *bitpos)
+ *
+ * Drop the bytes already decoded and block until more input arrives.
+ *
+ * Returns the number of bytes read, 0 at EOF
+ */
+static ssize_t adaptive_fill(uint8_t *in, size_t *end, size_t *bitpos) {
+    size_t consumed = *bitpos >> 3;
+    memmove(in, in + consumed, *end - consumed);
+    *end -= consumed;
+    *bitpos -= consumed * 8;
+
+    ssize_t n;
+    do {
+        n = read(STDIN_FILENO, in + *end, ADAPTIVE_BUFFER_SIZE - *end);
+    } while (n < 0 && errno == EINTR);
+
+    if (n > 0) {
+        *end += n;
+    }
+    return n;
+}
+
+/**
+ * adaptive_decode(void)
+ *
+ * Decode with the lookup table while at least one longest code's worth of
+ * bits has arrived; closer to the end of the input, walk the trie bit by bit
+ * and only read when a code is actually cut short.
+ */
+int adaptive_decode(void) {
+    AdaptiveModel *m = malloc(sizeof(AdaptiveModel));
+    Decoder *d = malloc(sizeof(Decoder));
+    uint8_t *in = calloc(ADAPTIVE_BUFFER_SIZE + 8, 1);
+    uint8_t *out = malloc(ADAPTIVE_BUFFER_SIZE);
+    size_t end = 0, bitpos = 0, written = 0;
+    const char *error = NULL;
+
+    while (end < 8 && error == NULL) {
+        if (adaptive_fill(in, &end, &bitpos) <= 0) {
+            error = "missing header";
+        }
+    }
+
+    if (error == NULL && get_u32(in) != ADAPTIVE_MAGIC) {
+        error = "not an adaptive stream";
+    }
+
+    size_t interval = error == NULL ? get_u32(in + 4) : 0;
+    if (error == NULL && (interval == 0 || interval > BLOCK_SIZE_MAX)) {
+        error = "bad interval";
+    }
+
+    if (error == NULL) {
+        bitpos = 64;
+        adaptive_init(m, interval);
+        decoder_init(d, m->codes, ADAPTIVE_SYMBOLS);
+    }
+
+    while (error == NULL) {
+        int symbol = 0;
+        if (end * 8 - bitpos >= (size_t) m->max_length) {
+            bitpos = decode_symbol(d, in, bitpos, end * 8, &symbol);
+            if (bitpos == SIZE_MAX) {
+                error = "corrupt stream";
+                break;
+            }
+        } else {
+            int node = 0;
+            while (1) {
+                if (bitpos == end * 8) {
+                    if (end == ADAPTIVE_BUFFER_SIZE && bitpos < 8 * 8) {
+                        error = "corrupt stream";
+                        break;
+                    }
+                    if (adaptive_fill(in, &end, &bitpos) <= 0) {
+                        error = "truncated stream";
+                        break;
+                    }
+                }
+
+                int bit = (in[bitpos >> 3] >> (7 - (bitpos & 7))) & 1;
+                int next = d->child[node][bit];
+                bitpos++;
+                if (next == 0) {
+                    error = "corrupt stream";
+                    break;
+                }
+
+                if (next < 0) {
+                    symbol = -next - 1;
+                    break;
+                }
+                node = next;
+            }
+
+            if (error != NULL) {
+                break;
+            }
+        }
+
+        if (symbol < 256) {
+            out[written++] = (uint8_t) symbol;
+            if (adaptive_update(m, symbol)) {
+                decoder_init(d, m->codes, ADAPTIVE_SYMBOLS);
+            }
+            if (written < ADAPTIVE_BUFFER_SIZE) {
+                continue;
+            }
+        } else {
+            bitpos = (bitpos + 7) & ~(size_t) 7;
+        }
+
+        if (write_all(out, written) != 0) {
+            error = strerror(errno);
+        }
+        written = 0;
+        if (symbol == ADAPTIVE_END) {
+            break;
+        }
+    }
+
+    if (error != NULL) {
+        // Whatever was decoded before a cut is still good output
+        if (strcmp(error, "truncated stream") == 0) {
+            write_all(out, written);
+        }
+        fprintf(stderr, "huffman: %s\n", error);
+    }
+
+    free(m);
+    free(d);
+    free(in);
+    free(out);
+    return error == NULL ? 0 : 1;
 }
@@ -1,321 +1,3669 @@
 #include <limits.h>
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
 
-#define PQ_HEAP_MAX_SIZE 10000
+#define OUTPUT_BUFFER_SIZE (1 << 16)
+// Next-hop rows kept in memory at once when computing every router's table
+#define ALL_SOURCES_WINDOW_BYTES (64 << 20)
+// Dial's queue keeps one bucket per cost up to the largest link cost; past
+// this many the radix heap is used instead
+#define DIAL_MAX_BUCKETS (1 << 20)
+// One bucket per bit of the distance, plus one for the last distance taken
+#define RADIX_BUCKETS 33
+#define BENCH_MIN_SECONDS 0.25
+// Frontier vertices a delta-stepping thread claims at a time
+#define DELTA_CHUNK 64
 
-typedef struct Edge {
-    int vertex;
-    int cost;
-    struct Edge *next;
-} Edge;
-
-typedef struct Vertex {
-    int id;
-    int color;
-    int distance;
-    int path;
-} Vertex;
-
-typedef struct Node {
-    Vertex *vertex;
-    struct Node *left;
-    struct Node *right;
-    int ts;
-} Node;
+// Most loop-free paths reported per destination with -k
+#define MAX_BACKUP_PATHS 8
+
+#define MAX_LANDMARKS 32
+
+#define SNAPSHOT_MAGIC "RTSN"
+#define SNAPSHOT_VERSION 1
+
+#define HIERARCHY_MAGIC "RTCH"
+#define HIERARCHY_VERSION 1
+// Vertices a witness search settles before it gives up and lets the
+// shortcut in; a missed witness only costs an extra shortcut
+#define WITNESS_SETTLE_LIMIT 100
+// Contraction stops once the cheapest vertex left has more links than this;
+// what remains is kept as a core searched in full, as on random topologies
+// with no hierarchy to find it would only grow denser
+#define HIERARCHY_CORE_DEGREE 32
+
+// Children per heap node; wider heaps are shallower and keep siblings on the
+// same cache line. Build with -DPQ_ARITY=2 or 8 to change it.
+#ifndef PQ_ARITY
+#define PQ_ARITY 4
+#endif
+
+#if PQ_ARITY != 2 && PQ_ARITY != 4 && PQ_ARITY != 8
+#error "PQ_ARITY must be 2, 4 or 8"
+#endif
+
+typedef struct Topology {
+    int num_vertices;
+    int num_links;
+    int max_cost;
+    // Links of vertex v are target/cost[offset[v]] up to offset[v + 1]
+    int *offset;
+    int *target;
+    int *cost;
+    // The snapshot the arrays point into, or NULL if they were allocated
+    void *mapping;
+    size_t mapping_size;
+} Topology;
 
 typedef struct PriorityQueue {
-    Node **heap;
+    int *heap;
+    int *position;
+    const int *distance;
     int size;
     int capacity;
-    int ts;
 } PriorityQueue;
 
-Node *node_create(Vertex *vertex);
-void node_destroy(Node *n);
+// Intrusive lists of queued vertices for the integer queue engines. Every
+// relaxation adds one entry, so a search needs at most num_links + 1.
+typedef struct Buckets {
+    int *head;
+    int *next;
+    int *vertex;
+    int num_buckets;
+    int size;
+    int capacity;
+} Buckets;
+
+// Per-vertex search state, one array per field so relaxation only touches
+// the fields it needs. hop is the first vertex after the source on the path.
+typedef struct ShortestPaths {
+    int *distance;
+    int *path;
+    int *hop;
+    bool *visited;
+    PriorityQueue pq;
+    Buckets buckets;
+} ShortestPaths;
+
+typedef struct IntList {
+    int *items;
+    int size;
+    int capacity;
+} IntList;
+
+typedef void (*Engine)(const Topology *t, ShortestPaths *sp, int start);
+
+typedef struct EngineName {
+    const char *name;
+    Engine run;
+} EngineName;
+
+typedef struct Output {
+    char buffer[OUTPUT_BUFFER_SIZE];
+    size_t size;
+} Output;
+
+// Shared by the all-sources workers; only next is written concurrently and
+// every worker fills its own rows
+typedef struct AllSources {
+    const Topology *t;
+    Engine engine;
+    int *rows;
+    int window;
+    int first;
+    int count;
+    atomic_int next;
+    bool done;
+    pthread_barrier_t start;
+    pthread_barrier_t finish;
+} AllSources;
+
+// Equal-cost next hops of one source. Bit i of a vertex's set stands for
+// neighbor[i], the source's neighbors in ascending order.
+typedef struct NextHops {
+    int num_neighbors;
+    int words;
+    int *neighbor;
+    uint64_t *sets;
+} NextHops;
+
+typedef struct Arc {
+    int target;
+    int cost;
+    int middle;
+} Arc;
+
+typedef struct ArcList {
+    Arc *items;
+    int size;
+    int capacity;
+} ArcList;
+
+// Contraction hierarchy: every vertex's links to vertices contracted after
+// it, shortcuts naming the vertex they bypass in middle (-1 for a real
+// link), plus the topology it was built from. Vertices left in the core
+// keep all their links to each other.
+typedef struct Hierarchy {
+    Topology *t;
+    unsigned char *core;
+    int num_up;
+    int *up_offset;
+    int *up_target;
+    int *up_cost;
+    int *up_middle;
+} Hierarchy;
+
+// Search state reset through the list of vertices it touched, so a search
+// costs only what it visits. edge is the upward link a vertex was reached by.
+typedef struct LocalSearch {
+    int *distance;
+    int *parent;
+    int *edge;
+    int *touched;
+    int num_touched;
+    PriorityQueue pq;
+} LocalSearch;
+
+// Scratch for point-to-point queries. fwd holds the upward search from the
+// source of the current query; known caches its distances to other
+// vertices (-1 until worked out). route is the answer.
+typedef struct Query {
+    const Hierarchy *h;
+    LocalSearch *fwd;
+    LocalSearch *bwd;
+    int *known;
+    int *touched;
+    int num_touched;
+    // Index of each vertex in path while loops are cut out, else -1
+    int *position;
+    IntList path;
+    IntList route;
+} Query;
+
+// Distances between every vertex and a few landmarks, vertex-major so the
+// estimate for a vertex reads one row; INT_MAX where they are not connected
+typedef struct Landmarks {
+    int count;
+    int *vertex;
+    int *distance;
+} Landmarks;
+
+// A loop-free path and the index of the vertex it branched off its parent
+// at; Yen's algorithm only branches it again from there on
+typedef struct Path {
+    int cost;
+    int deviation;
+    int length;
+    int *vertex;
+} Path;
+
+// Scratch for finding the k best paths to one destination. reverse searches
+// back from it for the exact A* heuristic of spur searches, only as far as
+// they ask.
+typedef struct Yen {
+    const Topology *t;
+    LocalSearch *reverse;
+    LocalSearch *search;
+    int *removed;
+    int stamp;
+    int blocked[MAX_BACKUP_PATHS];
+    int num_blocked;
+    Path found[MAX_BACKUP_PATHS];
+    int num_found;
+    Path *candidates;
+    int num_candidates;
+    int capacity;
+} Yen;
+
+// Shared state of one delta-stepping search. Distances are read and lowered
+// with atomic builtins while a phase runs; the barrier separates phases.
+typedef struct DeltaStepping {
+    const Topology *t;
+    int *distance;
+    int *claimed;
+    int *frontier;
+    int delta;
+    int ring;
+    int bucket;
+    int round;
+    atomic_int frontier_size;
+    atomic_int next;
+    atomic_int next_bucket;
+    pthread_barrier_t barrier;
+} DeltaStepping;
 
-PriorityQueue *pq_init(int capacity);
-void pq_insert(PriorityQueue *pq, Node *);
-Node *pq_extract(PriorityQueue *pq);
-void pq_destroy(PriorityQueue *pq);
+// A thread's own buckets (a ring covering the distances it can still push
+// into) and the vertices it settled in the current bucket
+typedef struct DeltaWorker {
+    DeltaStepping *ds;
+    IntList *buckets;
+    IntList settled;
+} DeltaWorker;
 
-void heapify(PriorityQueue *pq, int root);
-void heapsort(PriorityQueue *pq);
-int check_order(Node *a, Node *b);
+// Shortest path tree kept up to date across link events. Links brought up
+// after the case was read are chained per vertex in extra_*, and links that
+// go down keep their slot with a cost of -1.
+typedef struct Incremental {
+    Topology *t;
+    int start;
+    int *extra_head;
+    int *extra_next;
+    int *extra_target;
+    int *extra_cost;
+    int num_extra;
+    int extra_capacity;
+    int zero_links;
+    ShortestPaths *sp;
+    int *stack;
+    int *dirty;
+    int num_dirty;
+} Incremental;
 
-void dijkstra(Edge **edges, Vertex **vertices, int start, int num_vertices);
+Topology *topology_read(int num_vertices, int num_links);
+Topology *topology_build(int num_vertices, const int *links, int num_links);
+Topology *topology_generate(int num_vertices, int degree, int max_cost);
+void topology_destroy(Topology *t);
+Topology *read_case(int *start);
 
-void link_append(Edge **links, int a, int b, int cost);
-void link_destroy(Edge *edge);
+int write_snapshot(const char *file);
+int snapshot_write(const Topology *t, int start, const char *file);
+Topology *snapshot_map(const char *file, int *start);
 
-Vertex *vertex_create(int id);
+ShortestPaths *sp_init(int num_vertices);
+void sp_reset(ShortestPaths *sp, int num_vertices);
+void sp_destroy(ShortestPaths *sp);
+
+void pq_insert(PriorityQueue *pq, int vertex);
+void pq_decrease(PriorityQueue *pq, int vertex);
+int pq_extract(PriorityQueue *pq);
+
+void sift_up(PriorityQueue *pq, int i);
+void sift_down(PriorityQueue *pq, int i);
+int check_order(PriorityQueue *pq, int a, int b);
+
+void dijkstra(const Topology *t, ShortestPaths *sp, int start);
+void dijkstra_dial(const Topology *t, ShortestPaths *sp, int start);
+void dijkstra_radix(const Topology *t, ShortestPaths *sp, int start);
+void delta_stepping(const Topology *t, ShortestPaths *sp, int start);
+void settle_parents(const Topology *t, ShortestPaths *sp, int start);
+void *delta_worker(void *arg);
+void delta_relax(DeltaWorker *w, int from, bool light);
+bool atomic_lower(int *p, int value);
+void list_push(IntList *list, int value);
+Engine find_engine(const char *name);
+
+void buckets_reserve(Buckets *b, int num_buckets, int entries);
+void bucket_push(Buckets *b, int bucket, int vertex);
+
+double bench_now(void);
+void bench_run(const char *name, Topology **cases, const int *sources, int n);
+int benchmark(int argc, char *argv[]);
+
+void output_char(Output *out, char c);
+void output_int(Output *out, int n);
+void output_table(Output *out, const int *hop, int num_vertices);
+void output_next_hops(Output *out, const NextHops *nh, int num_vertices);
+void output_route(Output *out, int cost, const int *path, int length);
+void output_flush(Output *out);
+
+void all_sources(const Topology *t, Engine engine, int threads, Output *out);
+void all_sources_run(AllSources *job, ShortestPaths *sp);
+void *all_sources_worker(void *arg);
+
+NextHops *next_hops(const Topology *t, const ShortestPaths *sp, int start);
+void next_hops_destroy(NextHops *nh);
+int compare_ints(const void *a, const void *b);
+int compare_keys(const void *a, const void *b);
+
+LocalSearch *search_init(int num_vertices);
+void search_reset(LocalSearch *s);
+void search_reach(LocalSearch *s, int v, int distance, int parent, int edge);
+void search_destroy(LocalSearch *s);
+
+int build_hierarchy(const char *file);
+int answer_queries(const char *file);
+Hierarchy *hierarchy_build(Topology *t);
+int contract(ArcList *adj, LocalSearch *s, int v, bool apply);
+void arc_add(ArcList *adj, int from, int to, int cost, int middle);
+int hierarchy_write(const Hierarchy *h, const char *file);
+Hierarchy *hierarchy_read(const char *file);
+void hierarchy_destroy(Hierarchy *h);
+void upward_search(const Hierarchy *h, LocalSearch *s, int source);
+Query *query_init(const Hierarchy *h);
+void query_destroy(Query *q);
+int hierarchy_query(Query *q, int a, int b);
+int meet_distance(Query *q, int to, int *meet);
+int source_distance(Query *q, int v);
+void unpack(const Hierarchy *h, int from, int to, int middle, IntList *path);
+void unpack_climb(Query *q, int v);
+void unpack_path(Query *q, int meet);
+
+void landmark_queries(
+    const Topology *t, Engine engine, int count, Output *out
+);
+Landmarks *landmarks_build(const Topology *t, Engine engine, int count);
+void landmarks_destroy(Landmarks *lm);
+int landmark_bound(const Landmarks *lm, const int *to_target, int v);
+bool zero_cost_link(const Topology *t, int v);
+int alt_query(
+    const Topology *t, const Landmarks *lm, LocalSearch *s, int a, int b,
+    IntList *route, long *settled
+);
+
+void backup_paths(
+    const Topology *t, const ShortestPaths *sp, int start, int k,
+    const IntList *destinations, Output *out
+);
+void yen(Yen *y, const ShortestPaths *sp, int target, int k);
+bool spur_search(Yen *y, int spur, int target, int limit);
+int reverse_distance(Yen *y, int v, int limit);
+int link_cost_between(const Topology *t, int a, int b);
+int candidate_bound(const Yen *y, int needed);
+bool path_less(const Path *a, const Path *b);
+
+void run_events(Topology *t, int start, Output *out);
+Incremental *incremental_init(Topology *t, int start);
+void incremental_destroy(Incremental *inc);
+void incremental_event(Incremental *inc, int a, int b, int cost);
+void incremental_increase(Incremental *inc, int root);
+void incremental_decrease(Incremental *inc, int a, int b, int cost);
+void incremental_adopt(Incremental *inc, int v, int parent);
+int incremental_parent(Incremental *inc, int v);
+void incremental_repair(Incremental *inc);
+void incremental_settle(Incremental *inc);
+bool key_less(const int *distance, int a, int b);
+
+int link_first(const Incremental *inc, int v);
+int link_next(const Incremental *inc, int v, int e);
+int link_target(const Incremental *inc, int e);
+int *link_cost(Incremental *inc, int e);
+int link_weight(Incremental *inc, int a, int b);
+void link_update(Incremental *inc, int a, int b, int cost);
+
+EngineName engines[] = {
+    { "heap", dijkstra },
+    { "dial", dijkstra_dial },
+    { "radix", dijkstra_radix },
+    { "delta", delta_stepping },
+};
+
+// Bucket width and thread count of the delta engine; 0 picks them from the
+// topology and the number of processors
+int delta_width = 0;
+int delta_threads = 0;
+
+#define NUM_ENGINES ((int) (sizeof(engines) / sizeof(engines[0])))
 
 int main(int argc, char *argv[]) {
-    int n, l, s;
-    while (1) {
-        scanf("%d %d %d", &n, &l, &s);
+    int s;
+    const char *snapshot = NULL;
+    bool every_source = false, events = false, multipath = false;
+    int backups = 0, landmarks = 0;
+    IntList destinations = { NULL, 0, 0 };
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    Engine engine = dijkstra;
 
-        if (n == 0 && l == 0 && s == -1) {
-            return 0;
-        }
+    if (argc > 1 && strcmp(argv[1], "-b") == 0) {
+        return benchmark(argc - 2, argv + 2);
+    }
+    if (argc > 2 && strcmp(argv[1], "-C") == 0) {
+        return build_hierarchy(argv[2]);
+    }
+    if (argc > 2 && strcmp(argv[1], "-Q") == 0) {
+        return answer_queries(argv[2]);
+    }
+    if (argc > 2 && strcmp(argv[1], "-S") == 0) {
+        return write_snapshot(argv[2]);
+    }
 
-        Edge *links[n];
-        Vertex *vertices[n];
-        for (int i = 0; i < n; i++) {
-            links[i] = NULL;
-            vertices[i] = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-e") == 0 && i + 1 < argc) {
+            engine = find_engine(argv[++i]);
+            if (engine == NULL) {
+                fprintf(stderr, "unknown engine %s\n", argv[i]);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-D") == 0 && i + 1 < argc) {
+            delta_width = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-a") == 0) {
+            every_source = true;
+        } else if (strcmp(argv[i], "-m") == 0) {
+            multipath = true;
+        } else if (strcmp(argv[i], "-k") == 0 && i + 1 < argc) {
+            backups = atoi(argv[++i]);
+            if (backups < 1 || backups > MAX_BACKUP_PATHS) {
+                fprintf(stderr, "-k takes 1 to %d\n", MAX_BACKUP_PATHS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-d") == 0 && i + 1 < argc) {
+            for (char *next = argv[++i]; ; next++) {
+                list_push(&destinations, (int) strtol(next, &next, 10));
+                if (*next != ',') {
+                    break;
+                }
+            }
+        } else if (strcmp(argv[i], "-A") == 0 && i + 1 < argc) {
+            landmarks = atoi(argv[++i]);
+            if (landmarks < 1 || landmarks > MAX_LANDMARKS) {
+                fprintf(stderr, "-A takes 1 to %d\n", MAX_LANDMARKS);
+                return 1;
+            }
+        } else if (strcmp(argv[i], "-i") == 0) {
+            events = true;
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-L") == 0 && i + 1 < argc) {
+            snapshot = argv[++i];
+        } else {
+            fprintf(
+                stderr,
+                "usage: route [-e engine] [-D delta] "
+                "[-a | -i | -m | -k paths | -A landmarks]\n"
+                "             [-d destination,...] [-t threads] "
+                "[-L snapshot]\n"
+                "       route -C hierarchy | -Q hierarchy | -S snapshot\n"
+            );
+            return 1;
         }
+    }
 
-        int a, b, cost;
-        for (int i = 0; i < l; i++) {
-            scanf("%d %d %d", &a, &b, &cost);
-            if (vertices[a] == NULL) {
-                vertices[a] = vertex_create(a);
-            }
+    if (threads < 1) {
+        threads = 1;
+    }
+    // -a already keeps every processor busy with one search each
+    delta_threads = every_source ? 1 : threads;
 
-            if (vertices[b] == NULL) {
-                vertices[b] = vertex_create(b);
-            }
+    // A snapshot holds a single case, stdin any number of them
+    Topology *t = snapshot != NULL
+        ? snapshot_map(snapshot, &s) : read_case(&s);
+    if (snapshot != NULL && t == NULL) {
+        return 1;
+    }
 
-            link_append(links, a, b, cost);
-            link_append(links, b, a, cost);
+    Output *out = malloc(sizeof(Output));
+    out->size = 0;
+
+    for (; t != NULL; t = snapshot != NULL ? NULL : read_case(&s)) {
+        int n = t->num_vertices;
+        if (every_source) {
+            all_sources(t, engine, threads, out);
+            topology_destroy(t);
+            continue;
+        }
+        if (events) {
+            run_events(t, s, out);
+            topology_destroy(t);
+            continue;
         }
-        dijkstra(links, vertices, s, n);
+        if (landmarks > 0) {
+            landmark_queries(t, engine, landmarks, out);
+            topology_destroy(t);
+            continue;
+        }
+
+        ShortestPaths *sp = sp_init(n);
+        engine(t, sp, s);
         #if DEBUG
-            printf("CASE: %d %d %d: ", n, l, s);
+            printf("CASE: %d %d %d: ", n, t->num_links / 2, s);
         #endif
 
-        printf("(");
-        for (int i = 0; i < n; i++) {
-            int ancestor = -1;
-            if (vertices[i]->id != s) {
-                ancestor = i;
-                while (vertices[ancestor]->path != s) {
-                    ancestor = vertices[ancestor]->path;
-                }
-            }
-            printf("%d", ancestor);
-            if (i + 1 != n) {
-                printf(",");
-            }
+        if (backups > 0 && s >= 0 && s < n) {
+            backup_paths(t, sp, s, backups, &destinations, out);
+        } else if (multipath && s >= 0 && s < n) {
+            NextHops *nh = next_hops(t, sp, s);
+            output_next_hops(out, nh, n);
+            next_hops_destroy(nh);
+        } else {
+            output_table(out, sp->hop, n);
         }
-        printf(")\n");
 
-        for (int i = 0; i < n; i++) {
-            #if DEBUG
-                printf("%d: ", i);
-            #endif
-            link_destroy(links[i]);
-            #if DEBUG
-                printf("\n");
+        #if DEBUG
+            output_flush(out);
+            for (int i = 0; i < n; i++) {
                 printf(
                     "Distance from %d: %d through %d\n",
-                    s, vertices[i]->distance, vertices[i]->path
+                    s, sp->distance[i], sp->path[i]
                 );
-            #endif
-            free(vertices[i]);
-        }
+            }
+        #endif
+        sp_destroy(sp);
+        topology_destroy(t);
     }
+
+    output_flush(out);
+    free(out);
+    free(destinations.items);
+    return 0;
 }
 
-void dijkstra(Edge **edges, Vertex **vertices, int start, int num_vertices) {
-    PriorityQueue *pq = pq_init(num_vertices);
-    for (int i = 0; i < num_vertices; i++) {
-        if (vertices[i]->id == start) {
-            vertices[i]->distance = 0;
-        }
-        pq_insert(pq, node_create(vertices[i]));
-    }
+void dijkstra(const Topology *t, ShortestPaths *sp, int start) {
+    PriorityQueue *pq = &sp->pq;
+    int *distance = sp->distance, *path = sp->path, *hop = sp->hop;
+    bool *visited = sp->visited;
+
+    sp_reset(sp, t->num_vertices);
+    distance[start] = 0;
+    pq_insert(pq, start);
 
-    Node *n = NULL;
     while (pq->size > 0) {
-        n = pq_extract(pq);
-        Vertex *from = n->vertex;
-        Edge *e = edges[n->vertex->id];
-        from->color = 1;
-        while (e != NULL) {
-            Vertex *to = vertices[e->vertex];
-            int new_distance = from->distance + e->cost;
-            if (to->color != 1 && new_distance < to->distance) {
-                to->distance = from->distance + e->cost;
-                to->path = from->id;
-                heapsort(pq);
-            }
-            e = e->next;
+        int from = pq_extract(pq);
+        visited[from] = true;
+        for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+            int to = t->target[e];
+            int new_distance = distance[from] + t->cost[e];
+            if (!visited[to] && new_distance < distance[to]) {
+                distance[to] = new_distance;
+                path[to] = from;
+                hop[to] = from == start ? to : hop[from];
+                if (pq->position[to] < 0) {
+                    pq_insert(pq, to);
+                } else {
+                    pq_decrease(pq, to);
+                }
+            }
         }
         #if DEBUG
-            printf("Node: %d\n", n->vertex->id);
+            printf("Node: %d\n", from);
         #endif
-        free(n);
     }
-    pq_destroy(pq);
-}
-
-void link_append(Edge **links, int a, int b, int cost) {
-    Edge *edge = malloc(sizeof(Edge));
-    edge->vertex = b;
-    edge->cost = cost;
-    edge->next = *(links + a);
-    *(links + a) = edge;
 }
 
-void link_destroy(Edge *n) {
-    if (n == NULL) {
+/**
+ * dijkstra_dial(const Topology *t, ShortestPaths *sp, int start)
+ *
+ * Dijkstra over Dial's bucket queue: a ring of one bucket per distance up
+ * to the largest link cost, scanned in distance order. A vertex takes its
+ * parent when it is settled, by the same (distance, id) order the heap
+ * engine settles vertices in, so the tables match it for positive costs.
+ * Over zero-cost links the heap can settle a vertex before a smaller id
+ * at the same distance, so if any are reached the parents are redone by
+ * settle_parents.
+ */
+void dijkstra_dial(const Topology *t, ShortestPaths *sp, int start) {
+    if (t->max_cost >= DIAL_MAX_BUCKETS) {
+        dijkstra_radix(t, sp, start);
         return;
     }
 
-    Edge *temp = n->next;
-    #if DEBUG
-        printf("{%d, %d} ", n->vertex, n->cost);
-    #endif
+    Buckets *b = &sp->buckets;
+    int *distance = sp->distance, *path = sp->path, *hop = sp->hop;
+    bool *visited = sp->visited;
+    int span = t->max_cost + 1;
 
-    while (temp != NULL) {
-        #if DEBUG
-            printf("{%d, %d} ", temp->vertex, temp->cost);
-        #endif
-        free(n);
-        n = temp;
-        temp = n->next;
+    sp_reset(sp, t->num_vertices);
+    buckets_reserve(b, span, t->num_links + 1);
+    distance[start] = 0;
+    bucket_push(b, 0, start);
+
+    int queued = 1;
+    bool zero = false;
+    for (int d = 0; queued > 0; d++) {
+        int *head = &b->head[d % span];
+        while (*head >= 0) {
+            int from = b->vertex[*head];
+            *head = b->next[*head];
+            queued--;
+            if (visited[from] || distance[from] != d) {
+                continue;
+            }
+
+            int parent = -1;
+            for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+                int to = t->target[e], cost = t->cost[e];
+                if (cost == 0 && to != from) {
+                    zero = true;
+                }
+                if (visited[to]) {
+                    if (
+                        distance[to] + cost == d
+                        && (parent < 0 || key_less(distance, to, parent))
+                    ) {
+                        parent = to;
+                    }
+                } else if (d + cost < distance[to]) {
+                    distance[to] = d + cost;
+                    bucket_push(b, distance[to] % span, to);
+                    queued++;
+                }
+            }
+            visited[from] = true;
+            path[from] = parent;
+            hop[from] = parent < 0 ? -1 : parent == start ? from : hop[parent];
+        }
     }
 
-    free(n);
+    if (zero) {
+        settle_parents(t, sp, start);
+    }
 }
 
-Vertex *vertex_create(int id) {
-    Vertex *vertex = malloc(sizeof(Vertex));
-    vertex->id = id;
-    vertex->color = 0;
-    vertex->distance = INT_MAX;
-    vertex->path = -1;
+/**
+ * dijkstra_radix(const Topology *t, ShortestPaths *sp, int start)
+ *
+ * Dijkstra over a radix heap. A queued distance sits in the bucket of the
+ * highest bit where it differs from the last distance taken; when bucket 0
+ * runs dry the next non-empty bucket is split around its minimum. Parents
+ * are taken on settling and redone over zero-cost links, as in
+ * dijkstra_dial.
+ */
+void dijkstra_radix(const Topology *t, ShortestPaths *sp, int start) {
+    Buckets *b = &sp->buckets;
+    int *distance = sp->distance, *path = sp->path, *hop = sp->hop;
+    bool *visited = sp->visited;
+    unsigned int last = 0;
+
+    sp_reset(sp, t->num_vertices);
+    buckets_reserve(b, RADIX_BUCKETS, t->num_links + 1);
+    distance[start] = 0;
+    bucket_push(b, 0, start);
 
-    return vertex;
-}
+    int queued = 1;
+    bool zero = false;
+    while (queued > 0) {
+        if (b->head[0] < 0) {
+            int i = 1;
+            while (b->head[i] < 0) {
+                i++;
+            }
 
-Node *node_create(Vertex *vertex) {
-    Node *n = malloc(sizeof(Node));
-    n->vertex = vertex;
-    n->left = NULL;
-    n->right = NULL;
-    n->ts = 0;
-    return n;
-}
+            unsigned int min = UINT_MAX;
+            for (int entry = b->head[i]; entry >= 0; entry = b->next[entry]) {
+                int v = b->vertex[entry];
+                if (!visited[v] && (unsigned int) distance[v] < min) {
+                    min = distance[v];
+                }
+            }
 
-void node_destroy(Node *n) {
-    if (n->left != NULL) {
-        node_destroy(n->left);
+            int entry = b->head[i];
+            b->head[i] = -1;
+            if (min != UINT_MAX) {
+                last = min;
+            }
+            while (entry >= 0) {
+                int next = b->next[entry], v = b->vertex[entry];
+                if (visited[v]) {
+                    queued--;
+                } else {
+                    unsigned int diff = (unsigned int) distance[v] ^ last;
+                    int bucket = diff ? 32 - __builtin_clz(diff) : 0;
+                    b->next[entry] = b->head[bucket];
+                    b->head[bucket] = entry;
+                }
+                entry = next;
+            }
+            continue;
+        }
+
+        int from = b->vertex[b->head[0]];
+        b->head[0] = b->next[b->head[0]];
+        queued--;
+        if (visited[from] || (unsigned int) distance[from] != last) {
+            continue;
+        }
+
+        int parent = -1, d = distance[from];
+        for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+            int to = t->target[e], cost = t->cost[e];
+            if (cost == 0 && to != from) {
+                zero = true;
+            }
+            if (visited[to]) {
+                if (
+                    distance[to] + cost == d
+                    && (parent < 0 || key_less(distance, to, parent))
+                ) {
+                    parent = to;
+                }
+            } else if (d + cost < distance[to]) {
+                distance[to] = d + cost;
+                unsigned int diff = (unsigned int) distance[to] ^ last;
+                bucket_push(b, diff ? 32 - __builtin_clz(diff) : 0, to);
+                queued++;
+            }
+        }
+        visited[from] = true;
+        path[from] = parent;
+        hop[from] = parent < 0 ? -1 : parent == start ? from : hop[parent];
     }
-    if (n->right != NULL) {
-        node_destroy(n->right);
+
+    if (zero) {
+        settle_parents(t, sp, start);
     }
-    free(n);
 }
 
-PriorityQueue *pq_init(int capacity) {
-    PriorityQueue *pq = malloc(sizeof(PriorityQueue));
-    pq->size = 0;
-    pq->capacity = capacity;
-    pq->ts = 0;
-    pq->heap = malloc(sizeof(Node *) * capacity);
-    for (int i = 0; i < capacity; i++) {
-        pq->heap[i] = NULL;
+/**
+ * settle_parents(const Topology *t, ShortestPaths *sp, int start)
+ *
+ * Redo the parents and first hops from final distances the way dijkstra
+ * picks them: vertices are settled in its order, reaching along tight
+ * links only, and each takes the first settled vertex that reaches it.
+ */
+void settle_parents(const Topology *t, ShortestPaths *sp, int start) {
+    PriorityQueue *pq = &sp->pq;
+    int *distance = sp->distance, *path = sp->path, *hop = sp->hop;
+    bool *queued = sp->visited;
+
+    for (int v = 0; v < t->num_vertices; v++) {
+        path[v] = -1;
+        hop[v] = -1;
+        queued[v] = false;
     }
+    pq->size = 0;
+    queued[start] = true;
+    pq_insert(pq, start);
 
-    return pq;
+    while (pq->size > 0) {
+        int from = pq_extract(pq);
+        for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+            int to = t->target[e];
+            if (!queued[to] && distance[from] + t->cost[e] == distance[to]) {
+                queued[to] = true;
+                path[to] = from;
+                hop[to] = from == start ? to : hop[from];
+                pq_insert(pq, to);
+            }
+        }
+    }
 }
 
-void pq_insert(PriorityQueue *pq, Node *n) {
-    if (pq->size >= pq->capacity) {
+/**
+ * delta_stepping(const Topology *t, ShortestPaths *sp, int start)
+ *
+ * Delta-stepping over delta_threads threads. Distances are grouped into
+ * buckets delta wide; the lowest non-empty bucket is emptied in parallel
+ * rounds relaxing only light links (cost <= delta), which may refill it,
+ * then the heavy links of everything it settled are relaxed once.
+ *
+ * Parents are picked afterwards by the (distance, id) rule the other
+ * engines settle by, and first hops follow them, so for positive costs
+ * the tables do not depend on how the threads interleave. Zero-cost links
+ * break that rule, so when any are reached settle_parents picks them.
+ */
+void delta_stepping(const Topology *t, ShortestPaths *sp, int start) {
+    int n = t->num_vertices;
+    int threads = delta_threads > 0
+        ? delta_threads : (int) sysconf(_SC_NPROCESSORS_ONLN);
+    if (threads < 1) {
+        threads = 1;
+    }
+
+    DeltaStepping ds;
+    ds.t = t;
+    ds.distance = sp->distance;
+    ds.delta = delta_width;
+    if (ds.delta < 1) {
+        int links = t->num_links > 0 ? t->num_links : 1;
+        ds.delta = (int) ((long) t->max_cost * n / links);
+        if (ds.delta < 1) {
+            ds.delta = 1;
+        }
+    }
+    ds.ring = t->max_cost / ds.delta + 2;
+    ds.bucket = 0;
+    ds.round = 1;
+    ds.claimed = calloc(n, sizeof(int));
+    ds.frontier = malloc(sizeof(int) * (n > 0 ? n : 1));
+    atomic_store(&ds.frontier_size, 0);
+    atomic_store(&ds.next, 0);
+    atomic_store(&ds.next_bucket, INT_MAX);
+    pthread_barrier_init(&ds.barrier, NULL, threads);
+
+    sp_reset(sp, n);
+    sp->distance[start] = 0;
+
+    DeltaWorker workers[threads];
+    pthread_t ids[threads];
+    for (int i = 0; i < threads; i++) {
+        workers[i].ds = &ds;
+        workers[i].buckets = calloc(ds.ring, sizeof(IntList));
+        workers[i].settled.items = NULL;
+        workers[i].settled.size = 0;
+        workers[i].settled.capacity = 0;
+    }
+    list_push(&workers[0].buckets[0], start);
+
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&ids[i], NULL, delta_worker, &workers[i]);
+    }
+    delta_worker(&workers[0]);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(ids[i], NULL);
+    }
+
+    for (int i = 0; i < threads; i++) {
+        for (int b = 0; b < ds.ring; b++) {
+            free(workers[i].buckets[b].items);
+        }
+        free(workers[i].buckets);
+        free(workers[i].settled.items);
+    }
+    pthread_barrier_destroy(&ds.barrier);
+    free(ds.claimed);
+
+    // Parents are independent of each other; hops walk up to the nearest
+    // vertex with a known hop and fill in the way back down
+    int *distance = sp->distance, *path = sp->path, *hop = sp->hop;
+    int *stack = ds.frontier;
+    bool zero = false;
+    for (int v = 0; v < n; v++) {
+        int parent = -1;
+        if (v != start && distance[v] != INT_MAX) {
+            for (int e = t->offset[v]; e < t->offset[v + 1]; e++) {
+                int u = t->target[e];
+                if (t->cost[e] == 0 && u != v) {
+                    zero = true;
+                }
+                if (
+                    distance[u] != INT_MAX
+                    && distance[u] + t->cost[e] == distance[v]
+                    && key_less(distance, u, v)
+                    && (parent < 0 || key_less(distance, u, parent))
+                ) {
+                    parent = u;
+                }
+            }
+        }
+        path[v] = parent;
+    }
+
+    if (zero) {
+        settle_parents(t, sp, start);
+        free(ds.frontier);
         return;
     }
-    n->ts = pq->ts;
-    pq->heap[pq->size] = n;
-    pq->size++;
-    pq->ts++;
-    heapsort(pq);
+    for (int v = 0; v < n; v++) {
+        int depth = 0, u = v;
+        while (hop[u] < 0 && path[u] >= 0 && path[u] != start) {
+            stack[depth++] = u;
+            u = path[u];
+        }
+        if (hop[u] < 0 && path[u] == start) {
+            hop[u] = u;
+        }
+        while (depth > 0) {
+            int w = stack[--depth];
+            hop[w] = hop[path[w]];
+        }
+    }
+    free(ds.frontier);
 }
 
-Node *pq_extract(PriorityQueue *pq) {
-    if (pq->size == 0) {
-        return NULL;
+void *delta_worker(void *arg) {
+    DeltaWorker *w = arg;
+    DeltaStepping *ds = w->ds;
+
+    while (1) {
+        int bucket = ds->bucket;
+        IntList *own = &w->buckets[bucket % ds->ring];
+
+        while (1) {
+            for (int i = 0; i < own->size; i++) {
+                int v = own->items[i];
+                int d = __atomic_load_n(&ds->distance[v], __ATOMIC_RELAXED);
+                if (
+                    d / ds->delta == bucket
+                    && __atomic_exchange_n(
+                        &ds->claimed[v], ds->round, __ATOMIC_RELAXED
+                    ) != ds->round
+                ) {
+                    ds->frontier[atomic_fetch_add(&ds->frontier_size, 1)] = v;
+                }
+            }
+            own->size = 0;
+            pthread_barrier_wait(&ds->barrier);
+
+            int size = atomic_load(&ds->frontier_size);
+            if (size == 0) {
+                break;
+            }
+
+            int first;
+            while ((first = atomic_fetch_add(&ds->next, DELTA_CHUNK)) < size) {
+                int last = first + DELTA_CHUNK;
+                if (last > size) {
+                    last = size;
+                }
+                for (int i = first; i < last; i++) {
+                    list_push(&w->settled, ds->frontier[i]);
+                    delta_relax(w, ds->frontier[i], true);
+                }
+            }
+
+            int serial = pthread_barrier_wait(&ds->barrier);
+            if (serial == PTHREAD_BARRIER_SERIAL_THREAD) {
+                atomic_store(&ds->frontier_size, 0);
+                atomic_store(&ds->next, 0);
+                ds->round++;
+            }
+            pthread_barrier_wait(&ds->barrier);
+        }
+
+        for (int i = 0; i < w->settled.size; i++) {
+            delta_relax(w, w->settled.items[i], false);
+        }
+        w->settled.size = 0;
+
+        for (int k = 1; k < ds->ring; k++) {
+            if (w->buckets[(bucket + k) % ds->ring].size > 0) {
+                int expected = atomic_load(&ds->next_bucket);
+                while (
+                    bucket + k < expected
+                    && !atomic_compare_exchange_weak(
+                        &ds->next_bucket, &expected, bucket + k
+                    )
+                );
+                break;
+            }
+        }
+
+        pthread_barrier_wait(&ds->barrier);
+        int next = atomic_load(&ds->next_bucket);
+        int serial = pthread_barrier_wait(&ds->barrier);
+        if (serial == PTHREAD_BARRIER_SERIAL_THREAD) {
+            ds->bucket = next;
+            atomic_store(&ds->next_bucket, INT_MAX);
+        }
+        pthread_barrier_wait(&ds->barrier);
+        if (next == INT_MAX) {
+            break;
+        }
     }
+    return NULL;
+}
 
-    Node *n = pq->heap[0];
-    pq->size--;
-    pq->heap[0] = pq->heap[pq->size];
-    pq->heap[pq->size] = NULL;
-    heapify(pq, 0);
-    return n;
+/**
+ * delta_relax(DeltaWorker *w, int from, bool light)
+ *
+ * Relax the light or the heavy links of from, filing every vertex this
+ * thread brings closer in its own bucket for the new distance
+ */
+void delta_relax(DeltaWorker *w, int from, bool light) {
+    DeltaStepping *ds = w->ds;
+    const Topology *t = ds->t;
+    int d = __atomic_load_n(&ds->distance[from], __ATOMIC_RELAXED);
+
+    for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+        int cost = t->cost[e];
+        if ((cost <= ds->delta) != light) {
+            continue;
+        }
+        int to = t->target[e];
+        if (atomic_lower(&ds->distance[to], d + cost)) {
+            list_push(&w->buckets[(d + cost) / ds->delta % ds->ring], to);
+        }
+    }
 }
 
-void pq_destroy(PriorityQueue *pq) {
-    for (int i = 0; i < pq->capacity; i++) {
-        if (pq->heap[i] != NULL) {
-            node_destroy(pq->heap[i]);
+/**
+ * atomic_lower(int *p, int value)
+ *
+ * Atomically replace *p with value if value is smaller. Returns whether it
+ * did.
+ */
+bool atomic_lower(int *p, int value) {
+    int current = __atomic_load_n(p, __ATOMIC_RELAXED);
+    while (value < current) {
+        if (__atomic_compare_exchange_n(
+            p, &current, value, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED
+        )) {
+            return true;
         }
     }
-    free(pq->heap);
-    free(pq);
+    return false;
 }
 
-void heapify(PriorityQueue *pq, int root) {
-    Node *root_node = pq->heap[root];
-    int child = (root * 2) + 1;
+void list_push(IntList *list, int value) {
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 16;
+        list->items = realloc(list->items, sizeof(int) * list->capacity);
+    }
+    list->items[list->size++] = value;
+}
 
-    Node *child_node = NULL,
-         *sibling = NULL;
-    while (child < pq->size) {
-        child_node = pq->heap[child];
-        if (child + 1 < pq->size) {
-            sibling = pq->heap[child + 1];
-            if (check_order(child_node, sibling) == 1) {
-                child_node = sibling;
-                child += 1;
-            }
-        } else {
-            sibling = NULL;
+Engine find_engine(const char *name) {
+    for (int i = 0; i < NUM_ENGINES; i++) {
+        if (strcmp(engines[i].name, name) == 0) {
+            return engines[i].run;
         }
+    }
+    return NULL;
+}
 
-        if (check_order(root_node, child_node) == 1) {
-            pq->heap[root] = child_node;
-            root = child;
-            child = (root * 2) + 1;
-        } else {
+/**
+ * topology_read(int num_vertices, int num_links)
+ *
+ * Read num_links "a b cost" lines into compressed sparse rows: the first
+ * pass keeps the links and counts each vertex's degree, the second drops
+ * every link into both endpoints' slices.
+ */
+Topology *topology_read(int num_vertices, int num_links) {
+    int *links = malloc(sizeof(int) * 3 * (num_links > 0 ? num_links : 1));
+
+    int read = 0;
+    for (int i = 0; i < num_links; i++) {
+        int *link = links + 3 * read;
+        if (scanf("%d %d %d", &link[0], &link[1], &link[2]) != 3) {
             break;
         }
+        if (
+            link[0] < 0 || link[0] >= num_vertices
+            || link[1] < 0 || link[1] >= num_vertices
+        ) {
+            continue;
+        }
+        read++;
     }
-    pq->heap[root] = root_node;
+
+    Topology *t = topology_build(num_vertices, links, read);
+    free(links);
+    return t;
 }
 
-void heapsort(PriorityQueue *pq) {
-    for (int i = (pq->size - 1) / 2; i >= 0; --i) {
-        heapify(pq, i);
+/**
+ * topology_build(int num_vertices, const int *links, int num_links)
+ *
+ * Lay out num_links "a b cost" triples, endpoints in range, as compressed
+ * sparse rows: count each vertex's degree, then drop every link into both
+ * endpoints' slices.
+ */
+Topology *topology_build(int num_vertices, const int *links, int num_links) {
+    Topology *t = malloc(sizeof(Topology));
+    t->num_vertices = num_vertices;
+    t->num_links = 2 * num_links;
+    t->max_cost = 0;
+    t->mapping = NULL;
+    t->offset = calloc(num_vertices + 1, sizeof(int));
+
+    for (int i = 0; i < num_links; i++) {
+        t->offset[links[3 * i] + 1]++;
+        t->offset[links[3 * i + 1] + 1]++;
+        if (links[3 * i + 2] > t->max_cost) {
+            t->max_cost = links[3 * i + 2];
+        }
+    }
+
+    for (int v = 0; v < num_vertices; v++) {
+        t->offset[v + 1] += t->offset[v];
+    }
+
+    t->target = malloc(sizeof(int) * (t->num_links > 0 ? t->num_links : 1));
+    t->cost = malloc(sizeof(int) * (t->num_links > 0 ? t->num_links : 1));
+
+    int *fill = malloc(sizeof(int) * (num_vertices > 0 ? num_vertices : 1));
+    for (int v = 0; v < num_vertices; v++) {
+        fill[v] = t->offset[v];
+    }
+
+    for (int i = 0; i < num_links; i++) {
+        int a = links[3 * i], b = links[3 * i + 1], cost = links[3 * i + 2];
+        t->target[fill[a]] = b;
+        t->cost[fill[a]++] = cost;
+        t->target[fill[b]] = a;
+        t->cost[fill[b]++] = cost;
     }
+
+    free(fill);
+    return t;
 }
 
 /**
- * check_order(Node *a, Node *b)
+ * topology_generate(int num_vertices, int degree, int max_cost)
  *
- * Compare two nodes and determine which should be a root node when in an
- * almost heap
- *
- * Returns 1 if b should be root and -1 if a should be root
+ * Random connected topology for benchmarks: a spanning tree joining every
+ * vertex to one of the 64 before it, topped up with random links to an
+ * average of degree links per vertex, costs uniform in 1..max_cost
  */
-int check_order(Node *a, Node *b) {
-    int a_distance = a->vertex->distance,
-        b_distance = b->vertex->distance;
+Topology *topology_generate(int num_vertices, int degree, int max_cost) {
+    long count = (long) num_vertices * degree / 2;
+    if (count < num_vertices - 1) {
+        count = num_vertices - 1;
+    }
 
-    if (b_distance == a_distance && b->ts < a->ts) {
-        return 1;
+    int *links = malloc(sizeof(int) * 3 * (count > 0 ? count : 1));
+    uint64_t state = 0x9E3779B97F4A7C15ULL;
+    for (long i = 0; i < count; i++) {
+        uint64_t r[3];
+        for (int k = 0; k < 3; k++) {
+            state ^= state << 13;
+            state ^= state >> 7;
+            state ^= state << 17;
+            r[k] = state >> 16;
+        }
+
+        int a, b;
+        if (i < num_vertices - 1) {
+            a = (int) i + 1;
+            b = a - 1 - (int) (r[0] % (a < 64 ? a : 64));
+        } else {
+            a = (int) (r[0] % num_vertices);
+            b = (int) (r[1] % num_vertices);
+        }
+        links[3 * i] = a;
+        links[3 * i + 1] = b;
+        links[3 * i + 2] = 1 + (int) (r[2] % max_cost);
     }
 
-    if (b_distance == INT_MAX) {
-        return -1;
-    } else if (a_distance == INT_MAX) {
+    Topology *t = topology_build(num_vertices, links, (int) count);
+    free(links);
+    return t;
+}
+
+void topology_destroy(Topology *t) {
+    if (t->mapping != NULL) {
+        munmap(t->mapping, t->mapping_size);
+    } else {
+        free(t->offset);
+        free(t->target);
+        free(t->cost);
+    }
+    free(t);
+}
+
+/**
+ * read_case(int *start)
+ *
+ * Read the next "n l s" case from stdin, leaving its source in start.
+ * Returns NULL at the "0 0 -1" terminator or the end of the input.
+ */
+Topology *read_case(int *start) {
+    int n, l;
+    if (
+        scanf("%d %d %d", &n, &l, start) != 3
+        || (n == 0 && l == 0 && *start == -1)
+    ) {
+        return NULL;
+    }
+    return topology_read(n, l);
+}
+
+/**
+ * write_snapshot(const char *file)
+ *
+ * route -S file
+ *
+ * Convert the first case read from stdin to a snapshot in file
+ */
+int write_snapshot(const char *file) {
+    int s;
+    Topology *t = read_case(&s);
+    if (t == NULL) {
+        fprintf(stderr, "no topology to convert\n");
         return 1;
     }
 
-    if (b_distance < a_distance) {
+    int status = snapshot_write(t, s, file);
+    topology_destroy(t);
+    return status;
+}
+
+/**
+ * snapshot_write(const Topology *t, int start, const char *file)
+ *
+ * Save as the magic, a version, the vertex and link counts, the source
+ * and the largest cost, then the offset, target and cost arrays, all
+ * native ints, so the arrays can be used straight from a mapping
+ */
+int snapshot_write(const Topology *t, int start, const char *file) {
+    FILE *f = fopen(file, "wb");
+    if (f == NULL) {
+        perror(file);
+        return 1;
+    }
+
+    int n = t->num_vertices;
+    int header[5] = {
+        SNAPSHOT_VERSION, n, t->num_links, start, t->max_cost
+    };
+    size_t links = t->num_links;
+    bool ok = fwrite(SNAPSHOT_MAGIC, 1, 4, f) == 4
+        && fwrite(header, sizeof(int), 5, f) == 5
+        && fwrite(t->offset, sizeof(int), n + 1, f) == (size_t) n + 1
+        && fwrite(t->target, sizeof(int), links, f) == links
+        && fwrite(t->cost, sizeof(int), links, f) == links;
+
+    if (fclose(f) != 0 || !ok) {
+        perror(file);
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * snapshot_map(const char *file, int *start)
+ *
+ * Map a snapshot and point a topology's arrays into it, leaving its source
+ * in start. Only the header, the file size and the ends of offset are
+ * checked, so nothing but the pages a search touches is ever read. The
+ * mapping is private, so the costs can still be changed in place.
+ */
+Topology *snapshot_map(const char *file, int *start) {
+    int fd = open(file, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        perror(file);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    size_t size = st.st_size;
+    char *mapping = MAP_FAILED;
+    if (size >= 4 + 5 * sizeof(int)) {
+        mapping = mmap(
+            NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0
+        );
+    }
+    close(fd);
+    if (mapping == MAP_FAILED) {
+        fprintf(stderr, "%s: not a snapshot file\n", file);
+        return NULL;
+    }
+
+    int *header = (int *) (mapping + 4);
+    int n = header[1], links = header[2];
+    if (
+        memcmp(mapping, SNAPSHOT_MAGIC, 4) != 0
+        || header[0] != SNAPSHOT_VERSION || n <= 0 || links < 0
+        || size != 4 + sizeof(int) * (6 + (size_t) n + 2 * (size_t) links)
+        || header[5] != 0 || header[5 + n] != links
+    ) {
+        fprintf(stderr, "%s: not a snapshot file\n", file);
+        munmap(mapping, size);
+        return NULL;
+    }
+
+    Topology *t = malloc(sizeof(Topology));
+    t->num_vertices = n;
+    t->num_links = links;
+    t->max_cost = header[4];
+    t->offset = header + 5;
+    t->target = t->offset + n + 1;
+    t->cost = t->target + links;
+    t->mapping = mapping;
+    t->mapping_size = size;
+    *start = header[3];
+    return t;
+}
+
+ShortestPaths *sp_init(int num_vertices) {
+    ShortestPaths *sp = malloc(sizeof(ShortestPaths));
+    int size = num_vertices > 0 ? num_vertices : 1;
+    sp->distance = malloc(sizeof(int) * size);
+    sp->path = malloc(sizeof(int) * size);
+    sp->hop = malloc(sizeof(int) * size);
+    sp->visited = malloc(sizeof(bool) * size);
+    sp->pq.heap = malloc(sizeof(int) * size);
+    sp->pq.position = malloc(sizeof(int) * size);
+    sp->pq.distance = sp->distance;
+    sp->pq.capacity = num_vertices;
+    sp->pq.size = 0;
+    sp->buckets.head = NULL;
+    sp->buckets.next = NULL;
+    sp->buckets.vertex = NULL;
+    sp->buckets.num_buckets = 0;
+    sp->buckets.size = 0;
+    sp->buckets.capacity = 0;
+    return sp;
+}
+
+void sp_reset(ShortestPaths *sp, int num_vertices) {
+    for (int i = 0; i < num_vertices; i++) {
+        sp->distance[i] = INT_MAX;
+        sp->path[i] = -1;
+        sp->hop[i] = -1;
+        sp->visited[i] = false;
+        sp->pq.position[i] = -1;
+    }
+    sp->pq.size = 0;
+}
+
+void sp_destroy(ShortestPaths *sp) {
+    free(sp->distance);
+    free(sp->path);
+    free(sp->hop);
+    free(sp->visited);
+    free(sp->pq.heap);
+    free(sp->pq.position);
+    free(sp->buckets.head);
+    free(sp->buckets.next);
+    free(sp->buckets.vertex);
+    free(sp);
+}
+
+/**
+ * buckets_reserve(Buckets *b, int num_buckets, int entries)
+ *
+ * Empty num_buckets buckets and make room for entries entries, growing the
+ * arrays only when a search needs more than an earlier one did
+ */
+void buckets_reserve(Buckets *b, int num_buckets, int entries) {
+    if (num_buckets > b->num_buckets) {
+        b->head = realloc(b->head, sizeof(int) * num_buckets);
+        b->num_buckets = num_buckets;
+    }
+    if (entries > b->capacity) {
+        b->next = realloc(b->next, sizeof(int) * entries);
+        b->vertex = realloc(b->vertex, sizeof(int) * entries);
+        b->capacity = entries;
+    }
+    for (int i = 0; i < num_buckets; i++) {
+        b->head[i] = -1;
+    }
+    b->size = 0;
+}
+
+void bucket_push(Buckets *b, int bucket, int vertex) {
+    int entry = b->size++;
+    b->vertex[entry] = vertex;
+    b->next[entry] = b->head[bucket];
+    b->head[bucket] = entry;
+}
+
+/**
+ * all_sources(const Topology *t, Engine engine, int threads, Output *out)
+ *
+ * Write every router's table, row s being the table of source s. A pool of
+ * threads shares the read-only topology; each owns its search state for the
+ * whole case and claims sources one at a time, a window of rows at a time.
+ */
+void all_sources(const Topology *t, Engine engine, int threads, Output *out) {
+    int n = t->num_vertices;
+    if (n <= 0) {
+        return;
+    }
+
+    AllSources job;
+    size_t window = ALL_SOURCES_WINDOW_BYTES / (sizeof(int) * (size_t) n);
+    if (window < (size_t) threads) {
+        window = threads;
+    }
+    if (window > (size_t) n) {
+        window = n;
+    }
+
+    job.t = t;
+    job.engine = engine;
+    job.window = (int) window;
+    job.rows = malloc(sizeof(int) * window * n);
+    job.done = false;
+    pthread_barrier_init(&job.start, NULL, threads);
+    pthread_barrier_init(&job.finish, NULL, threads);
+
+    pthread_t workers[threads];
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&workers[i], NULL, all_sources_worker, &job);
+    }
+
+    ShortestPaths *sp = sp_init(n);
+    for (int first = 0; first < n; first += job.window) {
+        job.first = first;
+        job.count = n - first < job.window ? n - first : job.window;
+        atomic_store(&job.next, 0);
+
+        pthread_barrier_wait(&job.start);
+        all_sources_run(&job, sp);
+        pthread_barrier_wait(&job.finish);
+
+        for (int i = 0; i < job.count; i++) {
+            output_table(out, job.rows + (size_t) i * n, n);
+        }
+    }
+
+    job.done = true;
+    pthread_barrier_wait(&job.start);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    sp_destroy(sp);
+    pthread_barrier_destroy(&job.start);
+    pthread_barrier_destroy(&job.finish);
+    free(job.rows);
+}
+
+void all_sources_run(AllSources *job, ShortestPaths *sp) {
+    int n = job->t->num_vertices, i;
+    while ((i = atomic_fetch_add(&job->next, 1)) < job->count) {
+        job->engine(job->t, sp, job->first + i);
+        memcpy(job->rows + (size_t) i * n, sp->hop, sizeof(int) * n);
+    }
+}
+
+void *all_sources_worker(void *arg) {
+    AllSources *job = arg;
+    ShortestPaths *sp = sp_init(job->t->num_vertices);
+
+    while (1) {
+        pthread_barrier_wait(&job->start);
+        if (job->done) {
+            break;
+        }
+        all_sources_run(job, sp);
+        pthread_barrier_wait(&job->finish);
+    }
+
+    sp_destroy(sp);
+    return NULL;
+}
+
+/**
+ * next_hops(const Topology *t, const ShortestPaths *sp, int start)
+ *
+ * Collect every first hop on a shortest path to each vertex. Taking the
+ * vertices in settle order, a vertex's set is the union of the sets of all
+ * its parents on a shortest path, a parent that is the source itself
+ * standing for the vertex.
+ */
+NextHops *next_hops(const Topology *t, const ShortestPaths *sp, int start) {
+    NextHops *nh = malloc(sizeof(NextHops));
+    const int *distance = sp->distance;
+    int n = t->num_vertices, degree = t->offset[start + 1] - t->offset[start];
+
+    nh->neighbor = malloc(sizeof(int) * (degree > 0 ? degree : 1));
+    memcpy(nh->neighbor, t->target + t->offset[start], sizeof(int) * degree);
+    qsort(nh->neighbor, degree, sizeof(int), compare_ints);
+    nh->num_neighbors = 0;
+    for (int i = 0; i < degree; i++) {
+        if (i == 0 || nh->neighbor[i] != nh->neighbor[i - 1]) {
+            nh->neighbor[nh->num_neighbors++] = nh->neighbor[i];
+        }
+    }
+
+    int *rank = malloc(sizeof(int) * n);
+    for (int v = 0; v < n; v++) {
+        rank[v] = -1;
+    }
+    for (int i = 0; i < nh->num_neighbors; i++) {
+        rank[nh->neighbor[i]] = i;
+    }
+
+    int words = (nh->num_neighbors + 63) / 64;
+    nh->words = words > 0 ? words : 1;
+    nh->sets = calloc((size_t) n * nh->words, sizeof(uint64_t));
+
+    uint64_t *order = malloc(sizeof(uint64_t) * n);
+    int reached = 0;
+    for (int v = 0; v < n; v++) {
+        if (distance[v] != INT_MAX && v != start) {
+            order[reached++] = (uint64_t) distance[v] << 32 | (uint32_t) v;
+        }
+    }
+    qsort(order, reached, sizeof(uint64_t), compare_keys);
+
+    // Vertices at one distance take the sets of nearer ones first, then
+    // pass them on over zero-cost links between each other until nothing
+    // changes
+    int *stack = malloc(sizeof(int) * (n > 0 ? n : 1));
+    bool *stacked = calloc(n > 0 ? n : 1, sizeof(bool));
+    for (int i = 0, end = 0; i < reached; i = end) {
+        int depth = 0;
+        uint64_t level = order[i] >> 32;
+        for (; end < reached && order[end] >> 32 == level; end++) {
+            int v = (int) (uint32_t) order[end];
+            uint64_t *set = nh->sets + (size_t) v * nh->words;
+            for (int e = t->offset[v]; e < t->offset[v + 1]; e++) {
+                int u = t->target[e];
+                if (
+                    distance[u] == INT_MAX
+                    || distance[u] + t->cost[e] != distance[v]
+                    || (distance[u] == distance[v] && u != start)
+                ) {
+                    continue;
+                }
+                if (u == start) {
+                    set[rank[v] / 64] |= 1ULL << (rank[v] % 64);
+                    continue;
+                }
+                const uint64_t *parent = nh->sets + (size_t) u * nh->words;
+                for (int w = 0; w < nh->words; w++) {
+                    set[w] |= parent[w];
+                }
+            }
+            stack[depth++] = v;
+            stacked[v] = true;
+        }
+
+        while (depth > 0) {
+            int u = stack[--depth];
+            const uint64_t *from = nh->sets + (size_t) u * nh->words;
+            stacked[u] = false;
+            for (int e = t->offset[u]; e < t->offset[u + 1]; e++) {
+                int v = t->target[e];
+                if (t->cost[e] != 0 || v == start || v == u) {
+                    continue;
+                }
+                uint64_t *set = nh->sets + (size_t) v * nh->words;
+                bool changed = false;
+                for (int w = 0; w < nh->words; w++) {
+                    changed |= (from[w] & ~set[w]) != 0;
+                    set[w] |= from[w];
+                }
+                if (changed && !stacked[v]) {
+                    stack[depth++] = v;
+                    stacked[v] = true;
+                }
+            }
+        }
+    }
+
+    free(stack);
+    free(stacked);
+    free(order);
+    free(rank);
+    return nh;
+}
+
+void next_hops_destroy(NextHops *nh) {
+    free(nh->neighbor);
+    free(nh->sets);
+    free(nh);
+}
+
+int compare_ints(const void *a, const void *b) {
+    int x = *(const int *) a, y = *(const int *) b;
+    return (x > y) - (x < y);
+}
+
+int compare_keys(const void *a, const void *b) {
+    uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+    return (x > y) - (x < y);
+}
+
+LocalSearch *search_init(int num_vertices) {
+    LocalSearch *s = malloc(sizeof(LocalSearch));
+    int size = num_vertices > 0 ? num_vertices : 1;
+    s->distance = malloc(sizeof(int) * size);
+    s->parent = malloc(sizeof(int) * size);
+    s->edge = malloc(sizeof(int) * size);
+    s->touched = malloc(sizeof(int) * size);
+    s->num_touched = 0;
+    s->pq.heap = malloc(sizeof(int) * size);
+    s->pq.position = malloc(sizeof(int) * size);
+    s->pq.distance = s->distance;
+    s->pq.capacity = num_vertices;
+    s->pq.size = 0;
+    for (int v = 0; v < num_vertices; v++) {
+        s->distance[v] = INT_MAX;
+        s->pq.position[v] = -1;
+    }
+    return s;
+}
+
+void search_reset(LocalSearch *s) {
+    for (int i = 0; i < s->num_touched; i++) {
+        s->distance[s->touched[i]] = INT_MAX;
+        s->pq.position[s->touched[i]] = -1;
+    }
+    s->num_touched = 0;
+    s->pq.size = 0;
+}
+
+/**
+ * search_reach(LocalSearch *s, int v, int distance, int parent, int edge)
+ *
+ * Record a shorter distance to v and queue it
+ */
+void search_reach(LocalSearch *s, int v, int distance, int parent, int edge) {
+    if (s->distance[v] == INT_MAX) {
+        s->touched[s->num_touched++] = v;
+    }
+    s->distance[v] = distance;
+    s->parent[v] = parent;
+    s->edge[v] = edge;
+    if (s->pq.position[v] < 0) {
+        pq_insert(&s->pq, v);
+    } else {
+        pq_decrease(&s->pq, v);
+    }
+}
+
+void search_destroy(LocalSearch *s) {
+    free(s->distance);
+    free(s->parent);
+    free(s->edge);
+    free(s->touched);
+    free(s->pq.heap);
+    free(s->pq.position);
+    free(s);
+}
+
+/**
+ * build_hierarchy(const char *file)
+ *
+ * route -C file
+ *
+ * Contract the first case read from stdin and save the hierarchy to file
+ */
+int build_hierarchy(const char *file) {
+    int n, l, s;
+    if (scanf("%d %d %d", &n, &l, &s) != 3 || n <= 0) {
+        fprintf(stderr, "no topology to contract\n");
+        return 1;
+    }
+
+    Topology *t = topology_read(n, l);
+    Hierarchy *h = hierarchy_build(t);
+    int status = hierarchy_write(h, file);
+    hierarchy_destroy(h);
+    return status;
+}
+
+/**
+ * answer_queries(const char *file)
+ *
+ * route -Q file
+ *
+ * Answer "a b" lines from stdin with the cost of the cheapest path from a
+ * to b and the path itself, "cost (a,...,b)", or "-1 ()" if there is none
+ */
+int answer_queries(const char *file) {
+    Hierarchy *h = hierarchy_read(file);
+    if (h == NULL) {
+        return 1;
+    }
+
+    int n = h->t->num_vertices, a, b;
+    Query *q = query_init(h);
+    Output *out = malloc(sizeof(Output));
+    out->size = 0;
+
+    while (scanf("%d %d", &a, &b) == 2) {
+        int cost = -1;
+        q->route.size = 0;
+        if (a >= 0 && a < n && b >= 0 && b < n) {
+            cost = hierarchy_query(q, a, b);
+        }
+
+        output_route(out, cost, q->route.items, q->route.size);
+        output_char(out, '\n');
+    }
+
+    output_flush(out);
+    free(out);
+    query_destroy(q);
+    hierarchy_destroy(h);
+    return 0;
+}
+
+/**
+ * hierarchy_build(Topology *t)
+ *
+ * Contract vertices one at a time, cheapest first by edge difference (the
+ * shortcuts contracting a vertex adds less the links it removes) plus its
+ * already contracted neighbors. Priorities are only brought up to date
+ * when a vertex reaches the front of the queue. Contracting a vertex drops
+ * the links back to it, so what is left of its own links all go up.
+ */
+Hierarchy *hierarchy_build(Topology *t) {
+    int n = t->num_vertices;
+    ArcList *adj = calloc(n, sizeof(ArcList));
+    int *priority = malloc(sizeof(int) * n);
+    int *removed = calloc(n, sizeof(int));
+    LocalSearch *s = search_init(n);
+
+    for (int v = 0; v < n; v++) {
+        for (int e = t->offset[v]; e < t->offset[v + 1]; e++) {
+            if (t->target[e] != v) {
+                arc_add(adj, v, t->target[e], t->cost[e], -1);
+            }
+        }
+    }
+
+    PriorityQueue order;
+    order.heap = malloc(sizeof(int) * n);
+    order.position = malloc(sizeof(int) * n);
+    order.distance = priority;
+    order.capacity = n;
+    order.size = 0;
+    for (int v = 0; v < n; v++) {
+        priority[v] = contract(adj, s, v, false) - adj[v].size;
+        order.position[v] = -1;
+        pq_insert(&order, v);
+    }
+
+    unsigned char *core = calloc(n, 1);
+    while (order.size > 0) {
+        int v = pq_extract(&order), degree = adj[v].size;
+        if (degree > HIERARCHY_CORE_DEGREE) {
+            core[v] = 1;
+            while (order.size > 0) {
+                core[pq_extract(&order)] = 1;
+            }
+            break;
+        }
+
+        priority[v] = contract(adj, s, v, false) - degree + removed[v];
+        if (order.size > 0 && priority[v] > priority[order.heap[0]]) {
+            pq_insert(&order, v);
+            continue;
+        }
+
+        contract(adj, s, v, true);
+
+        for (int i = 0; i < adj[v].size; i++) {
+            ArcList *back = &adj[adj[v].items[i].target];
+            for (int k = 0; k < back->size; k++) {
+                if (back->items[k].target == v) {
+                    back->items[k] = back->items[--back->size];
+                    break;
+                }
+            }
+            removed[adj[v].items[i].target]++;
+        }
+    }
+
+    Hierarchy *h = malloc(sizeof(Hierarchy));
+    h->t = t;
+    h->core = core;
+    h->up_offset = malloc(sizeof(int) * (n + 1));
+    h->up_offset[0] = 0;
+    for (int v = 0; v < n; v++) {
+        h->up_offset[v + 1] = h->up_offset[v] + adj[v].size;
+    }
+
+    h->num_up = h->up_offset[n];
+    int size = h->num_up > 0 ? h->num_up : 1;
+    h->up_target = malloc(sizeof(int) * size);
+    h->up_cost = malloc(sizeof(int) * size);
+    h->up_middle = malloc(sizeof(int) * size);
+    for (int v = 0; v < n; v++) {
+        for (int i = 0; i < adj[v].size; i++) {
+            int e = h->up_offset[v] + i;
+            h->up_target[e] = adj[v].items[i].target;
+            h->up_cost[e] = adj[v].items[i].cost;
+            h->up_middle[e] = adj[v].items[i].middle;
+        }
+        free(adj[v].items);
+    }
+
+    free(adj);
+    free(priority);
+    free(removed);
+    free(order.heap);
+    free(order.position);
+    search_destroy(s);
+    return h;
+}
+
+/**
+ * contract(ArcList *adj, LocalSearch *s, int v, bool apply)
+ *
+ * Count the shortcuts contracting v needs: a pair of its neighbors needs
+ * one unless a witness search from the first, avoiding v, finds a path no
+ * longer than the one through v. Adds them too if apply is set.
+ */
+int contract(ArcList *adj, LocalSearch *s, int v, bool apply) {
+    const Arc *arcs = adj[v].items;
+    int size = adj[v].size, shortcuts = 0;
+
+    for (int i = 0; i < size; i++) {
+        int u = arcs[i].target, limit = 0;
+        for (int j = i + 1; j < size; j++) {
+            if (arcs[j].cost > limit) {
+                limit = arcs[j].cost;
+            }
+        }
+        limit += arcs[i].cost;
+
+        search_reset(s);
+        search_reach(s, u, 0, -1, -1);
+        int settled = 0;
+        while (s->pq.size > 0 && settled++ < WITNESS_SETTLE_LIMIT) {
+            int from = pq_extract(&s->pq);
+            if (s->distance[from] > limit) {
+                break;
+            }
+            for (int k = 0; k < adj[from].size; k++) {
+                const Arc *arc = &adj[from].items[k];
+                int d = s->distance[from] + arc->cost;
+                int to = arc->target;
+                if (to != v && d <= limit && d < s->distance[to]) {
+                    search_reach(s, to, d, from, -1);
+                }
+            }
+        }
+
+        for (int j = i + 1; j < size; j++) {
+            int w = arcs[j].target, through = arcs[i].cost + arcs[j].cost;
+            if (s->distance[w] <= through) {
+                continue;
+            }
+            shortcuts++;
+            if (apply) {
+                arc_add(adj, u, w, through, v);
+                arc_add(adj, w, u, through, v);
+                arcs = adj[v].items;
+            }
+        }
+    }
+    return shortcuts;
+}
+
+/**
+ * arc_add(ArcList *adj, int from, int to, int cost, int middle)
+ *
+ * Add a link from from to to, or lower the cost of the one already there
+ */
+void arc_add(ArcList *adj, int from, int to, int cost, int middle) {
+    ArcList *list = &adj[from];
+    for (int i = 0; i < list->size; i++) {
+        if (list->items[i].target == to) {
+            if (cost < list->items[i].cost) {
+                list->items[i].cost = cost;
+                list->items[i].middle = middle;
+            }
+            return;
+        }
+    }
+
+    if (list->size == list->capacity) {
+        list->capacity = list->capacity ? 2 * list->capacity : 4;
+        list->items = realloc(list->items, sizeof(Arc) * list->capacity);
+    }
+    list->items[list->size].target = to;
+    list->items[list->size].cost = cost;
+    list->items[list->size].middle = middle;
+    list->size++;
+}
+
+/**
+ * hierarchy_write(const Hierarchy *h, const char *file)
+ *
+ * Save as the magic, a version, the vertex, link and upward link counts,
+ * then the topology's offset, target and cost arrays, the upward offset,
+ * target, cost and middle arrays, all native ints, and a core flag byte
+ * per vertex
+ */
+int hierarchy_write(const Hierarchy *h, const char *file) {
+    FILE *f = fopen(file, "wb");
+    if (f == NULL) {
+        perror(file);
+        return 1;
+    }
+
+    const Topology *t = h->t;
+    int n = t->num_vertices;
+    int header[4] = { HIERARCHY_VERSION, n, t->num_links, h->num_up };
+    size_t links = t->num_links, up = h->num_up;
+    bool ok = fwrite(HIERARCHY_MAGIC, 1, 4, f) == 4
+        && fwrite(header, sizeof(int), 4, f) == 4
+        && fwrite(t->offset, sizeof(int), n + 1, f) == (size_t) n + 1
+        && fwrite(t->target, sizeof(int), links, f) == links
+        && fwrite(t->cost, sizeof(int), links, f) == links
+        && fwrite(h->up_offset, sizeof(int), n + 1, f) == (size_t) n + 1
+        && fwrite(h->up_target, sizeof(int), up, f) == up
+        && fwrite(h->up_cost, sizeof(int), up, f) == up
+        && fwrite(h->up_middle, sizeof(int), up, f) == up
+        && fwrite(h->core, 1, n, f) == (size_t) n;
+
+    if (fclose(f) != 0 || !ok) {
+        perror(file);
+        return 1;
+    }
+    return 0;
+}
+
+Hierarchy *hierarchy_read(const char *file) {
+    FILE *f = fopen(file, "rb");
+    if (f == NULL) {
+        perror(file);
+        return NULL;
+    }
+
+    char magic[4];
+    int header[4];
+    if (
+        fread(magic, 1, 4, f) != 4 || memcmp(magic, HIERARCHY_MAGIC, 4) != 0
+        || fread(header, sizeof(int), 4, f) != 4
+        || header[0] != HIERARCHY_VERSION
+        || header[1] < 0 || header[2] < 0 || header[3] < 0
+    ) {
+        fprintf(stderr, "%s: not a hierarchy file\n", file);
+        fclose(f);
+        return NULL;
+    }
+
+    int n = header[1], links = header[2], up = header[3];
+    Hierarchy *h = malloc(sizeof(Hierarchy));
+    Topology *t = malloc(sizeof(Topology));
+    h->t = t;
+    h->num_up = up;
+    t->num_vertices = n;
+    t->num_links = links;
+    t->mapping = NULL;
+    t->offset = malloc(sizeof(int) * (n + 1));
+    t->target = malloc(sizeof(int) * (links > 0 ? links : 1));
+    t->cost = malloc(sizeof(int) * (links > 0 ? links : 1));
+    h->up_offset = malloc(sizeof(int) * (n + 1));
+    h->up_target = malloc(sizeof(int) * (up > 0 ? up : 1));
+    h->up_cost = malloc(sizeof(int) * (up > 0 ? up : 1));
+    h->up_middle = malloc(sizeof(int) * (up > 0 ? up : 1));
+    h->core = malloc(n > 0 ? n : 1);
+
+    bool ok = fread(t->offset, sizeof(int), n + 1, f) == (size_t) n + 1
+        && fread(t->target, sizeof(int), links, f) == (size_t) links
+        && fread(t->cost, sizeof(int), links, f) == (size_t) links
+        && fread(h->up_offset, sizeof(int), n + 1, f) == (size_t) n + 1
+        && fread(h->up_target, sizeof(int), up, f) == (size_t) up
+        && fread(h->up_cost, sizeof(int), up, f) == (size_t) up
+        && fread(h->up_middle, sizeof(int), up, f) == (size_t) up
+        && fread(h->core, 1, n, f) == (size_t) n;
+    fclose(f);
+
+    if (!ok) {
+        fprintf(stderr, "%s: truncated hierarchy file\n", file);
+        hierarchy_destroy(h);
+        return NULL;
+    }
+
+    t->max_cost = 0;
+    for (int e = 0; e < links; e++) {
+        if (t->cost[e] > t->max_cost) {
+            t->max_cost = t->cost[e];
+        }
+    }
+    return h;
+}
+
+void hierarchy_destroy(Hierarchy *h) {
+    topology_destroy(h->t);
+    free(h->up_offset);
+    free(h->up_target);
+    free(h->up_cost);
+    free(h->up_middle);
+    free(h->core);
+    free(h);
+}
+
+/**
+ * upward_search(const Hierarchy *h, LocalSearch *s, int source)
+ *
+ * Settle everything reachable from source over upward links only. A vertex
+ * that a higher neighbor already reached for less is not on any cheapest
+ * path up, so it is left unexpanded with its distance too high.
+ */
+void upward_search(const Hierarchy *h, LocalSearch *s, int source) {
+    search_reset(s);
+    search_reach(s, source, 0, -1, -1);
+    while (s->pq.size > 0) {
+        int from = pq_extract(&s->pq);
+        bool stalled = false;
+        for (int e = h->up_offset[from]; e < h->up_offset[from + 1]; e++) {
+            int above = s->distance[h->up_target[e]];
+            if (above != INT_MAX && above + h->up_cost[e] < s->distance[from]) {
+                stalled = true;
+                break;
+            }
+        }
+        if (stalled) {
+            continue;
+        }
+
+        for (int e = h->up_offset[from]; e < h->up_offset[from + 1]; e++) {
+            int to = h->up_target[e], d = s->distance[from] + h->up_cost[e];
+            if (d < s->distance[to]) {
+                search_reach(s, to, d, from, e);
+            }
+        }
+    }
+}
+
+Query *query_init(const Hierarchy *h) {
+    Query *q = malloc(sizeof(Query));
+    int n = h->t->num_vertices;
+    q->h = h;
+    q->fwd = search_init(n);
+    q->bwd = search_init(n);
+    q->known = malloc(sizeof(int) * (n > 0 ? n : 1));
+    q->touched = malloc(sizeof(int) * (n > 0 ? n : 1));
+    q->position = malloc(sizeof(int) * (n > 0 ? n : 1));
+    q->num_touched = 0;
+    for (int v = 0; v < n; v++) {
+        q->known[v] = -1;
+        q->position[v] = -1;
+    }
+    q->path.items = NULL;
+    q->path.size = q->path.capacity = 0;
+    q->route.items = NULL;
+    q->route.size = q->route.capacity = 0;
+    return q;
+}
+
+void query_destroy(Query *q) {
+    search_destroy(q->fwd);
+    search_destroy(q->bwd);
+    free(q->known);
+    free(q->touched);
+    free(q->position);
+    free(q->path.items);
+    free(q->route.items);
+    free(q);
+}
+
+/**
+ * hierarchy_query(Query *q, int a, int b)
+ *
+ * Write to q->route the path from a to b that dijkstra from a would
+ * report, and return its cost, or -1 if b is unreachable.
+ *
+ * Unpacking gives some cheapest path. Walking back from b, a vertex's
+ * parent in dijkstra is its neighbor on a cheapest path that comes first
+ * by (distance, id), so only neighbors that would come before the unpacked
+ * one need their distance from a. The path is unpacked again whenever one
+ * of them wins, and each switch lowers the distance, so the walk ends.
+ *
+ * That order only holds for positive costs: dijkstra can settle a vertex
+ * with a zero-cost link after a larger id at the same distance. Once the
+ * walk reaches such a vertex, the route is taken from the parents of a
+ * plain search from a instead.
+ */
+int hierarchy_query(Query *q, int a, int b) {
+    const Topology *t = q->h->t;
+    IntList *path = &q->path, *route = &q->route;
+    int meet;
+
+    for (int i = 0; i < q->num_touched; i++) {
+        q->known[q->touched[i]] = -1;
+    }
+    q->num_touched = 0;
+    route->size = 0;
+
+    upward_search(q->h, q->fwd, a);
+    int total = meet_distance(q, b, &meet);
+    if (total == INT_MAX) {
+        return -1;
+    }
+    unpack_path(q, meet);
+
+    int x = b, distance = total, i = path->size - 1;
+    list_push(route, b);
+    while (x != a) {
+        // Vertices joined by zero-cost links need not settle by id, so
+        // dijkstra's route is asked of dijkstra
+        if (zero_cost_link(t, x)) {
+            long settled = 0;
+            route->size = 0;
+            alt_query(t, NULL, q->bwd, a, b, route, &settled);
+            return total;
+        }
+
+        int best = path->items[i - 1], best_distance = -1;
+        for (int e = t->offset[x]; e < t->offset[x + 1]; e++) {
+            int d = distance - t->cost[e];
+            if (t->target[e] == best && d > best_distance) {
+                best_distance = d;
+            }
+        }
+
+        int unpacked = best;
+        for (int e = t->offset[x]; e < t->offset[x + 1]; e++) {
+            int u = t->target[e], d = distance - t->cost[e];
+            if (
+                d < 0 || d == distance || d > best_distance
+                || (d == best_distance && u >= best)
+            ) {
+                continue;
+            }
+            if (source_distance(q, u) == d) {
+                best = u;
+                best_distance = d;
+            }
+        }
+
+        if (best != unpacked) {
+            meet_distance(q, best, &meet);
+            unpack_path(q, meet);
+            i = path->size - 1;
+        } else {
+            i--;
+        }
+        x = best;
+        distance = best_distance;
+        list_push(route, x);
+    }
+
+    for (int l = 0, r = route->size - 1; l < r; l++, r--) {
+        int swap = route->items[l];
+        route->items[l] = route->items[r];
+        route->items[r] = swap;
+    }
+    return total;
+}
+
+/**
+ * meet_distance(Query *q, int to, int *meet)
+ *
+ * Search upward from to and return its distance from the source, the best
+ * sum over the vertices both upward searches reached. The vertex achieving
+ * it goes in meet.
+ */
+int meet_distance(Query *q, int to, int *meet) {
+    LocalSearch *fwd = q->fwd, *bwd = q->bwd;
+    int best = INT_MAX;
+    *meet = -1;
+    upward_search(q->h, bwd, to);
+    for (int i = 0; i < bwd->num_touched; i++) {
+        int v = bwd->touched[i];
+        if (
+            fwd->distance[v] != INT_MAX
+            && fwd->distance[v] + bwd->distance[v] < best
+        ) {
+            best = fwd->distance[v] + bwd->distance[v];
+            *meet = v;
+        }
+    }
+    return best;
+}
+
+/**
+ * source_distance(Query *q, int v)
+ *
+ * Distance from the source to v. The last link of a cheapest path comes
+ * down to v from a vertex ranked higher, i.e. along one of v's upward
+ * links, unless the upward search from the source reached v directly, so
+ * the distance follows from those of v's upward neighbors. The upward
+ * search already has the right distance to the core. Each vertex is
+ * worked out once per query.
+ */
+int source_distance(Query *q, int v) {
+    const Hierarchy *h = q->h;
+    if (h->core[v]) {
+        return q->fwd->distance[v];
+    }
+    if (q->known[v] >= 0) {
+        return q->known[v];
+    }
+
+    int best = q->fwd->distance[v];
+    for (int e = h->up_offset[v]; e < h->up_offset[v + 1]; e++) {
+        int d = source_distance(q, h->up_target[e]);
+        if (d != INT_MAX && d + h->up_cost[e] < best) {
+            best = d + h->up_cost[e];
+        }
+    }
+
+    q->known[v] = best;
+    q->touched[q->num_touched++] = v;
+    return best;
+}
+
+/**
+ * unpack(const Hierarchy *h, int from, int to, int middle, IntList *path)
+ *
+ * Append the real vertices of the link from from to to, after from, to
+ * path. Both halves of a shortcut are upward links of its middle vertex.
+ */
+void unpack(const Hierarchy *h, int from, int to, int middle, IntList *path) {
+    if (middle < 0) {
+        list_push(path, to);
+        return;
+    }
+
+    int halves[2] = { from, to }, inner[2] = { -1, -1 };
+    for (int e = h->up_offset[middle]; e < h->up_offset[middle + 1]; e++) {
+        for (int k = 0; k < 2; k++) {
+            if (h->up_target[e] == halves[k]) {
+                inner[k] = h->up_middle[e];
+            }
+        }
+    }
+    unpack(h, from, middle, inner[0], path);
+    unpack(h, middle, to, inner[1], path);
+}
+
+/**
+ * unpack_climb(Query *q, int v)
+ *
+ * Append the real path from the source up to v
+ */
+void unpack_climb(Query *q, int v) {
+    int parent = q->fwd->parent[v];
+    if (parent < 0) {
+        list_push(&q->path, v);
+        return;
+    }
+    unpack_climb(q, parent);
+    unpack(q->h, parent, v, q->h->up_middle[q->fwd->edge[v]], &q->path);
+}
+
+/**
+ * unpack_path(Query *q, int meet)
+ *
+ * Write to q->path the real path from the source up to meet and back down
+ * to the vertex q->bwd searched from. Shortcuts over zero-cost links can
+ * pass through a vertex twice; the loop in between costs nothing and is
+ * cut out.
+ */
+void unpack_path(Query *q, int meet) {
+    const LocalSearch *bwd = q->bwd;
+    IntList *path = &q->path;
+    path->size = 0;
+    unpack_climb(q, meet);
+    for (int v = meet; bwd->parent[v] >= 0; v = bwd->parent[v]) {
+        int middle = q->h->up_middle[bwd->edge[v]];
+        unpack(q->h, v, bwd->parent[v], middle, path);
+    }
+
+    int size = 0;
+    for (int i = 0; i < path->size; i++) {
+        int v = path->items[i];
+        if (q->position[v] >= 0) {
+            while (size > q->position[v] + 1) {
+                q->position[path->items[--size]] = -1;
+            }
+            continue;
+        }
+        q->position[v] = size;
+        path->items[size++] = v;
+    }
+    path->size = size;
+    for (int i = 0; i < size; i++) {
+        q->position[path->items[i]] = -1;
+    }
+}
+
+/**
+ * landmark_queries(const Topology *t, Engine engine, int count, Output *out)
+ *
+ * Pick count landmarks, then answer "a b" lines from stdin like route -Q
+ * with A* searches bounded by them. The vertices those settle are summed
+ * up on stderr against what dijkstra settles for the same queries.
+ */
+void landmark_queries(
+    const Topology *t, Engine engine, int count, Output *out
+) {
+    int n = t->num_vertices, a, b;
+    Landmarks *lm = landmarks_build(t, engine, count);
+    LocalSearch *s = search_init(n);
+    IntList route = { NULL, 0, 0 };
+    long settled = 0, plain = 0, queries = 0;
+
+    while (scanf("%d %d", &a, &b) == 2) {
+        int cost = -1;
+        route.size = 0;
+        if (a >= 0 && a < n && b >= 0 && b < n) {
+            cost = alt_query(t, lm, s, a, b, &route, &settled);
+            alt_query(t, NULL, s, a, b, NULL, &plain);
+        }
+        queries++;
+
+        output_route(out, cost, route.items, route.size);
+        output_char(out, '\n');
+    }
+
+    output_flush(out);
+    fflush(stdout);
+    fprintf(
+        stderr, "%ld queries: %ld vertices settled, dijkstra settles %ld\n",
+        queries, settled, plain
+    );
+    free(route.items);
+    search_destroy(s);
+    landmarks_destroy(lm);
+}
+
+/**
+ * landmarks_build(const Topology *t, Engine engine, int count)
+ *
+ * Farthest selection: start from the vertex farthest from vertex 0, then
+ * keep adding the vertex farthest from every landmark so far, preferring
+ * ones none of them reaches. Each landmark's distances come from one run
+ * of engine, so -e delta spreads them over the threads.
+ */
+Landmarks *landmarks_build(const Topology *t, Engine engine, int count) {
+    int n = t->num_vertices;
+    if (count > n) {
+        count = n;
+    }
+
+    Landmarks *lm = malloc(sizeof(Landmarks));
+    lm->count = count;
+    lm->vertex = malloc(sizeof(int) * count);
+    lm->distance = malloc(sizeof(int) * (size_t) n * count);
+
+    ShortestPaths *sp = sp_init(n);
+    int *nearest = malloc(sizeof(int) * n);
+    engine(t, sp, 0);
+    for (int v = 0; v < n; v++) {
+        nearest[v] = sp->distance[v] == INT_MAX ? -1 : sp->distance[v];
+    }
+
+    // nearest is the distance to the closest landmark so far, INT_MAX if
+    // none reaches the vertex, and before the first one, from vertex 0
+    for (int i = 0; i < count; i++) {
+        int next = 0;
+        for (int v = 1; v < n; v++) {
+            if (nearest[v] > nearest[next]) {
+                next = v;
+            }
+        }
+
+        lm->vertex[i] = next;
+        engine(t, sp, next);
+        for (int v = 0; v < n; v++) {
+            int d = sp->distance[v];
+            lm->distance[(size_t) v * count + i] = d;
+            if (i == 0 || d < nearest[v]) {
+                nearest[v] = d;
+            }
+        }
+    }
+
+    free(nearest);
+    sp_destroy(sp);
+    return lm;
+}
+
+void landmarks_destroy(Landmarks *lm) {
+    free(lm->vertex);
+    free(lm->distance);
+    free(lm);
+}
+
+/**
+ * landmark_bound(const Landmarks *lm, const int *to_target, int v)
+ *
+ * Lower bound on the distance from v to the target whose landmark row is
+ * to_target, by the triangle inequality; INT_MAX if some landmark reaches
+ * exactly one of them. Without landmarks it is 0.
+ */
+int landmark_bound(const Landmarks *lm, const int *to_target, int v) {
+    if (lm == NULL) {
+        return 0;
+    }
+
+    const int *row = lm->distance + (size_t) v * lm->count;
+    int bound = 0;
+    for (int i = 0; i < lm->count; i++) {
+        if (row[i] == INT_MAX || to_target[i] == INT_MAX) {
+            if (row[i] != to_target[i]) {
+                return INT_MAX;
+            }
+            continue;
+        }
+
+        int d = row[i] > to_target[i]
+            ? row[i] - to_target[i] : to_target[i] - row[i];
+        if (d > bound) {
+            bound = d;
+        }
+    }
+    return bound;
+}
+
+/**
+ * zero_cost_link(const Topology *t, int v)
+ *
+ * Whether v has a zero-cost link to another vertex
+ */
+bool zero_cost_link(const Topology *t, int v) {
+    for (int e = t->offset[v]; e < t->offset[v + 1]; e++) {
+        if (t->cost[e] == 0 && t->target[e] != v) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * alt_query(const Topology *t, const Landmarks *lm, LocalSearch *s, int a,
+ *           int b, IntList *route, long *settled)
+ *
+ * A* from a to b keyed by distance plus landmark bound, or plain dijkstra
+ * without landmarks, adding the vertices it settles to settled. Returns
+ * the cost, -1 if b cannot be reached, and fills route unless it is NULL.
+ *
+ * The search settles every vertex keyed no higher than the cost, which
+ * covers every cheapest path, so the route can be walked back the way
+ * dijkstra would have taken it: through the predecessor settled first,
+ * the one first by (distance, id). Zero-cost links break that order, so a
+ * walk that meets one starts over with the parents of a plain search.
+ */
+int alt_query(
+    const Topology *t, const Landmarks *lm, LocalSearch *s, int a, int b,
+    IntList *route, long *settled
+) {
+    const int *to_target = lm ? lm->distance + (size_t) b * lm->count : NULL;
+    int h = landmark_bound(lm, to_target, a), cost = -1;
+    if (h == INT_MAX) {
+        return -1;
+    }
+
+    search_reset(s);
+    search_reach(s, a, h, -1, -1);
+    while (s->pq.size > 0) {
+        if (cost >= 0 && s->distance[s->pq.heap[0]] > cost) {
+            break;
+        }
+        int from = pq_extract(&s->pq);
+        (*settled)++;
+        if (from == b) {
+            cost = s->distance[from];
+        }
+
+        int g = s->distance[from] - landmark_bound(lm, to_target, from);
+        for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+            int to = t->target[e], bound = landmark_bound(lm, to_target, to);
+            if (bound == INT_MAX) {
+                continue;
+            }
+            int key = g + t->cost[e] + bound;
+            if (key < s->distance[to]) {
+                search_reach(s, to, key, from, -1);
+            }
+        }
+    }
+
+    if (cost < 0 || route == NULL) {
+        return cost;
+    }
+
+    // At b the bound is exact, so its key is its distance. Without
+    // landmarks the search is dijkstra's, and so are its parents.
+    int first = route->size;
+    for (int v = b; ; ) {
+        list_push(route, v);
+        if (v == a) {
+            break;
+        }
+        if (lm == NULL) {
+            v = s->parent[v];
+            continue;
+        }
+        if (zero_cost_link(t, v)) {
+            route->size = first;
+            return alt_query(t, NULL, s, a, b, route, settled);
+        }
+
+        int dv = s->distance[v] - landmark_bound(lm, to_target, v);
+        int best = -1, best_distance = 0;
+        for (int e = t->offset[v]; e < t->offset[v + 1]; e++) {
+            int u = t->target[e];
+            if (s->distance[u] == INT_MAX) {
+                continue;
+            }
+            int du = s->distance[u] - landmark_bound(lm, to_target, u);
+            if (
+                du + t->cost[e] == dv && du < dv
+                && (
+                    best < 0 || du < best_distance
+                    || (du == best_distance && u < best)
+                )
+            ) {
+                best = u;
+                best_distance = du;
+            }
+        }
+        v = best;
+    }
+
+    for (int i = first, j = route->size - 1; i < j; i++, j--) {
+        int swap = route->items[i];
+        route->items[i] = route->items[j];
+        route->items[j] = swap;
+    }
+    return cost;
+}
+
+/**
+ * backup_paths(const Topology *t, const ShortestPaths *sp, int start, int k,
+ *              const IntList *destinations, Output *out)
+ *
+ * Write a line per destination other than start, "v:" followed by its k
+ * cheapest loop-free paths as " cost (start,...,v)", cheapest first. The
+ * first one is the path in sp's tree. The destinations are every vertex,
+ * or those listed in the order given if there are any.
+ *
+ * The spur searches of a destination need every distance to it they come
+ * across, so each destination costs a search back from it, though only
+ * as far as they ask. With every vertex a destination that is close to a
+ * search per vertex, hence the list.
+ */
+void backup_paths(
+    const Topology *t, const ShortestPaths *sp, int start, int k,
+    const IntList *destinations, Output *out
+) {
+    int n = t->num_vertices;
+    Yen y;
+    y.t = t;
+    y.reverse = search_init(n);
+    y.search = search_init(n);
+    y.removed = calloc(n, sizeof(int));
+    y.stamp = 0;
+    y.candidates = NULL;
+    y.num_candidates = 0;
+    y.capacity = 0;
+
+    int count = destinations->size > 0 ? destinations->size : n;
+    for (int i = 0; i < count; i++) {
+        int v = destinations->size > 0 ? destinations->items[i] : i;
+        if (v < 0 || v >= n || v == start) {
+            continue;
+        }
+
+        search_reset(y.reverse);
+        search_reach(y.reverse, v, 0, -1, -1);
+        yen(&y, sp, v, k);
+
+        output_int(out, v);
+        output_char(out, ':');
+        for (int j = 0; j < y.num_found; j++) {
+            const Path *path = &y.found[j];
+            output_char(out, ' ');
+            output_route(out, path->cost, path->vertex, path->length);
+            free(path->vertex);
+        }
+        output_char(out, '\n');
+    }
+
+    free(y.candidates);
+    free(y.removed);
+    search_destroy(y.search);
+    search_destroy(y.reverse);
+}
+
+/**
+ * yen(Yen *y, const ShortestPaths *sp, int target, int k)
+ *
+ * Yen's algorithm with Lawler's refinement: every path found is branched
+ * off at each of its vertices from its own deviation point on. A branch
+ * keeps the path up to the spur vertex, may not revisit it, and may not
+ * leave the spur the way an already found path with the same prefix did.
+ *
+ * A spur search that cannot beat the candidates already good enough to
+ * fill the remaining places is cut short.
+ */
+void yen(Yen *y, const ShortestPaths *sp, int target, int k) {
+    const Topology *t = y->t;
+    y->num_found = 0;
+    y->num_candidates = 0;
+    if (sp->distance[target] == INT_MAX) {
+        return;
+    }
+
+    Path *first = &y->found[y->num_found++];
+    first->cost = sp->distance[target];
+    first->deviation = 0;
+    first->length = 0;
+    for (int v = target; v >= 0; v = sp->path[v]) {
+        first->length++;
+    }
+    first->vertex = malloc(sizeof(int) * first->length);
+    for (int v = target, i = first->length - 1; v >= 0; v = sp->path[v]) {
+        first->vertex[i--] = v;
+    }
+
+    LocalSearch *s = y->search;
+    while (y->num_found < k) {
+        const Path *last = &y->found[y->num_found - 1];
+        const int *root = last->vertex;
+        int root_cost = 0;
+        for (int i = 0; i < last->deviation; i++) {
+            root_cost += link_cost_between(t, root[i], root[i + 1]);
+        }
+
+        for (int i = last->deviation; i + 1 < last->length; i++) {
+            int spur = root[i];
+            if (i > last->deviation) {
+                root_cost += link_cost_between(t, root[i - 1], spur);
+            }
+
+            y->stamp++;
+            for (int j = 0; j < i; j++) {
+                y->removed[root[j]] = y->stamp;
+            }
+            y->num_blocked = 0;
+            for (int p = 0; p < y->num_found; p++) {
+                const Path *other = &y->found[p];
+                if (
+                    other->length > i + 1
+                    && memcmp(other->vertex, root, sizeof(int) * (i + 1)) == 0
+                ) {
+                    y->blocked[y->num_blocked++] = other->vertex[i + 1];
+                }
+            }
+
+            int bound = candidate_bound(y, k - y->num_found);
+            int limit = bound == INT_MAX ? INT_MAX : bound - root_cost;
+            if (
+                reverse_distance(y, spur, limit) == INT_MAX
+                || !spur_search(y, spur, target, limit)
+            ) {
+                continue;
+            }
+
+            int spur_length = 0;
+            for (int v = target; v != spur; v = s->parent[v]) {
+                spur_length++;
+            }
+
+            Path candidate;
+            candidate.cost = root_cost + s->distance[target];
+            candidate.deviation = i;
+            candidate.length = i + 1 + spur_length;
+            candidate.vertex = malloc(sizeof(int) * candidate.length);
+            memcpy(candidate.vertex, root, sizeof(int) * (i + 1));
+            int j = candidate.length - 1;
+            for (int v = target; v != spur; v = s->parent[v]) {
+                candidate.vertex[j--] = v;
+            }
+
+            bool duplicate = false;
+            for (int c = 0; c < y->num_candidates && !duplicate; c++) {
+                const Path *other = &y->candidates[c];
+                duplicate = other->length == candidate.length
+                    && memcmp(
+                        other->vertex, candidate.vertex,
+                        sizeof(int) * candidate.length
+                    ) == 0;
+            }
+            if (duplicate) {
+                free(candidate.vertex);
+                continue;
+            }
+
+            if (y->num_candidates == y->capacity) {
+                y->capacity = y->capacity ? 2 * y->capacity : 16;
+                size_t size = sizeof(Path) * y->capacity;
+                y->candidates = realloc(y->candidates, size);
+            }
+            y->candidates[y->num_candidates++] = candidate;
+        }
+
+        if (y->num_candidates == 0) {
+            break;
+        }
+
+        int best = 0;
+        for (int c = 1; c < y->num_candidates; c++) {
+            if (path_less(&y->candidates[c], &y->candidates[best])) {
+                best = c;
+            }
+        }
+        y->found[y->num_found++] = y->candidates[best];
+        y->candidates[best] = y->candidates[--y->num_candidates];
+    }
+
+    for (int c = 0; c < y->num_candidates; c++) {
+        free(y->candidates[c].vertex);
+    }
+    y->num_candidates = 0;
+}
+
+/**
+ * spur_search(Yen *y, int spur, int target, int limit)
+ *
+ * A* from spur to target around the removed vertices, not leaving spur
+ * towards a blocked one. The search keys are estimated total costs, so
+ * it gives up once they pass limit, and a vertex whose key would is never
+ * queued. On success the spur path's cost is the target's key and the
+ * path runs back through parent.
+ */
+bool spur_search(Yen *y, int spur, int target, int limit) {
+    const Topology *t = y->t;
+    const int *h = y->reverse->distance;
+    LocalSearch *s = y->search;
+
+    search_reset(s);
+    search_reach(s, spur, h[spur], -1, -1);
+    while (s->pq.size > 0) {
+        int from = pq_extract(&s->pq);
+        if (s->distance[from] > limit) {
+            return false;
+        }
+        if (from == target) {
+            return true;
+        }
+
+        int g = s->distance[from] - h[from];
+        for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+            int to = t->target[e];
+            if (y->removed[to] == y->stamp) {
+                continue;
+            }
+            bool skip = false;
+            for (int b = 0; b < y->num_blocked && from == spur; b++) {
+                skip |= y->blocked[b] == to;
+            }
+            if (skip) {
+                continue;
+            }
+
+            int rest = limit == INT_MAX ? INT_MAX : limit - g - t->cost[e];
+            if (reverse_distance(y, to, rest) == INT_MAX) {
+                continue;
+            }
+            int f = g + t->cost[e] + h[to];
+            if (f < s->distance[to]) {
+                search_reach(s, to, f, from, -1);
+            }
+        }
+    }
+    return false;
+}
+
+/**
+ * reverse_distance(Yen *y, int v, int limit)
+ *
+ * Distance from v to the destination, settling the reverse search up to
+ * it first if need be. INT_MAX if it is more than limit or there is none.
+ */
+int reverse_distance(Yen *y, int v, int limit) {
+    const Topology *t = y->t;
+    LocalSearch *r = y->reverse;
+
+    while (r->distance[v] == INT_MAX || r->pq.position[v] >= 0) {
+        if (r->pq.size == 0 || r->distance[r->pq.heap[0]] > limit) {
+            return INT_MAX;
+        }
+        int from = pq_extract(&r->pq);
+        for (int e = t->offset[from]; e < t->offset[from + 1]; e++) {
+            int to = t->target[e], d = r->distance[from] + t->cost[e];
+            if (d < r->distance[to]) {
+                search_reach(r, to, d, -1, -1);
+            }
+        }
+    }
+    return r->distance[v] > limit ? INT_MAX : r->distance[v];
+}
+
+/**
+ * link_cost_between(const Topology *t, int a, int b)
+ *
+ * Returns the cheapest link between a and b
+ */
+int link_cost_between(const Topology *t, int a, int b) {
+    int cost = INT_MAX;
+    for (int e = t->offset[a]; e < t->offset[a + 1]; e++) {
+        if (t->target[e] == b && t->cost[e] < cost) {
+            cost = t->cost[e];
+        }
+    }
+    return cost;
+}
+
+/**
+ * candidate_bound(const Yen *y, int needed)
+ *
+ * Cost of the needed-th cheapest candidate, past which a new one can no
+ * longer make it in, or INT_MAX if there are fewer candidates
+ */
+int candidate_bound(const Yen *y, int needed) {
+    if (y->num_candidates < needed) {
+        return INT_MAX;
+    }
+
+    int cheapest[MAX_BACKUP_PATHS], count = 0;
+    for (int c = 0; c < y->num_candidates; c++) {
+        int cost = y->candidates[c].cost, i = count < needed ? count++ : needed;
+        if (i == needed && cost >= cheapest[needed - 1]) {
+            continue;
+        }
+        if (i == needed) {
+            i--;
+        }
+        while (i > 0 && cheapest[i - 1] > cost) {
+            cheapest[i] = cheapest[i - 1];
+            i--;
+        }
+        cheapest[i] = cost;
+    }
+    return cheapest[needed - 1];
+}
+
+/**
+ * path_less(const Path *a, const Path *b)
+ *
+ * Order paths by cost, then by length, then by their vertices
+ */
+bool path_less(const Path *a, const Path *b) {
+    if (a->cost != b->cost) {
+        return a->cost < b->cost;
+    }
+    if (a->length != b->length) {
+        return a->length < b->length;
+    }
+    for (int i = 0; i < a->length; i++) {
+        if (a->vertex[i] != b->vertex[i]) {
+            return a->vertex[i] < b->vertex[i];
+        }
+    }
+    return false;
+}
+
+/**
+ * run_events(Topology *t, int start, Output *out)
+ *
+ * Write the table of start, then read a count of link events, each an
+ * "a b cost" line, and write the table again after every one. An event sets
+ * the cost of every link between a and b, bringing one up if there is none;
+ * a negative cost takes them down.
+ */
+void run_events(Topology *t, int start, Output *out) {
+    int num_events, a, b, cost;
+    if (start < 0 || start >= t->num_vertices) {
+        return;
+    }
+
+    Incremental *inc = incremental_init(t, start);
+    output_table(out, inc->sp->hop, t->num_vertices);
+
+    if (scanf("%d", &num_events) != 1) {
+        num_events = 0;
+    }
+    for (int i = 0; i < num_events; i++) {
+        if (scanf("%d %d %d", &a, &b, &cost) != 3) {
+            break;
+        }
+        if (
+            a >= 0 && a < t->num_vertices
+            && b >= 0 && b < t->num_vertices && a != b
+        ) {
+            incremental_event(inc, a, b, cost);
+        }
+        output_table(out, inc->sp->hop, t->num_vertices);
+    }
+
+    incremental_destroy(inc);
+}
+
+Incremental *incremental_init(Topology *t, int start) {
+    Incremental *inc = malloc(sizeof(Incremental));
+    int n = t->num_vertices;
+
+    inc->t = t;
+    inc->start = start;
+    inc->extra_head = malloc(sizeof(int) * n);
+    for (int v = 0; v < n; v++) {
+        inc->extra_head[v] = -1;
+    }
+    inc->extra_next = NULL;
+    inc->extra_target = NULL;
+    inc->extra_cost = NULL;
+    inc->num_extra = 0;
+    inc->extra_capacity = 0;
+    inc->zero_links = 0;
+    for (int v = 0; v < n; v++) {
+        for (int e = t->offset[v]; e < t->offset[v + 1]; e++) {
+            if (t->cost[e] == 0 && t->target[e] != v) {
+                inc->zero_links++;
+            }
+        }
+    }
+    inc->stack = malloc(sizeof(int) * n);
+    inc->dirty = malloc(sizeof(int) * 2 * n);
+    inc->num_dirty = 0;
+
+    inc->sp = sp_init(n);
+    dijkstra(t, inc->sp, start);
+    for (int v = 0; v < n; v++) {
+        inc->sp->visited[v] = false;
+    }
+    return inc;
+}
+
+void incremental_destroy(Incremental *inc) {
+    free(inc->extra_head);
+    free(inc->extra_next);
+    free(inc->extra_target);
+    free(inc->extra_cost);
+    free(inc->stack);
+    free(inc->dirty);
+    sp_destroy(inc->sp);
+    free(inc);
+}
+
+/**
+ * incremental_event(Incremental *inc, int a, int b, int cost)
+ *
+ * Apply a link event and bring the tree up to date. Only vertices whose
+ * distance or parent changes, and the subtrees whose first hop changes with
+ * them, are touched.
+ *
+ * Parents follow the rule dijkstra settles them by: the neighbor on a
+ * shortest path that comes first by (distance, id). This matches a full
+ * run as long as link costs are positive.
+ */
+void incremental_event(Incremental *inc, int a, int b, int cost) {
+    int *path = inc->sp->path;
+    int old_weight = link_weight(inc, a, b);
+    int new_weight = cost < 0 ? INT_MAX : cost;
+
+    link_update(inc, a, b, cost);
+    if (new_weight > old_weight) {
+        if (path[b] == a) {
+            incremental_increase(inc, b);
+        } else if (path[a] == b) {
+            incremental_increase(inc, a);
+        }
+    } else if (new_weight < old_weight) {
+        incremental_decrease(inc, a, b, new_weight);
+    }
+    if (inc->zero_links > 0) {
+        incremental_settle(inc);
+    } else {
+        incremental_repair(inc);
+    }
+}
+
+/**
+ * incremental_increase(Incremental *inc, int root)
+ *
+ * The link from root to its parent got worse, so only the subtree under
+ * root can move. Forget its distances, seed each vertex from its neighbors
+ * outside the subtree, and settle the subtree again.
+ */
+void incremental_increase(Incremental *inc, int root) {
+    ShortestPaths *sp = inc->sp;
+    PriorityQueue *pq = &sp->pq;
+    int *distance = sp->distance, *path = sp->path;
+    bool *in_subtree = sp->visited;
+    int count = 0;
+
+    inc->stack[count++] = root;
+    in_subtree[root] = true;
+    for (int i = 0; i < count; i++) {
+        int parent = inc->stack[i];
+        for (
+            int e = link_first(inc, parent); e >= 0;
+            e = link_next(inc, parent, e)
+        ) {
+            int child = link_target(inc, e);
+            if (!in_subtree[child] && path[child] == parent) {
+                in_subtree[child] = true;
+                inc->stack[count++] = child;
+            }
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        distance[inc->stack[i]] = INT_MAX;
+        path[inc->stack[i]] = -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        int v = inc->stack[i];
+        for (int e = link_first(inc, v); e >= 0; e = link_next(inc, v, e)) {
+            int u = link_target(inc, e), cost = *link_cost(inc, e);
+            if (cost < 0 || in_subtree[u] || distance[u] == INT_MAX) {
+                continue;
+            }
+            if (distance[u] + cost < distance[v]) {
+                distance[v] = distance[u] + cost;
+            }
+        }
+        if (distance[v] != INT_MAX) {
+            pq_insert(pq, v);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        in_subtree[inc->stack[i]] = false;
+        inc->dirty[inc->num_dirty++] = inc->stack[i];
+    }
+
+    while (pq->size > 0) {
+        int from = pq_extract(pq);
+        path[from] = incremental_parent(inc, from);
+        for (
+            int e = link_first(inc, from); e >= 0;
+            e = link_next(inc, from, e)
+        ) {
+            int to = link_target(inc, e), cost = *link_cost(inc, e);
+            if (cost < 0 || distance[from] + cost >= distance[to]) {
+                continue;
+            }
+            distance[to] = distance[from] + cost;
+            if (pq->position[to] < 0) {
+                pq_insert(pq, to);
+            } else {
+                pq_decrease(pq, to);
+            }
+        }
+    }
+}
+
+/**
+ * incremental_decrease(Incremental *inc, int a, int b, int cost)
+ *
+ * The link between a and b got better. Vertices it brings closer are
+ * settled again from the closer endpoint outwards; the search stops where
+ * distances no longer drop. Neighbors whose distance holds may still take
+ * a settled vertex as their parent on a tie.
+ */
+void incremental_decrease(Incremental *inc, int a, int b, int cost) {
+    ShortestPaths *sp = inc->sp;
+    PriorityQueue *pq = &sp->pq;
+    int *distance = sp->distance, *path = sp->path;
+    int ends[2][2] = {{a, b}, {b, a}};
+
+    for (int i = 0; i < 2; i++) {
+        int from = ends[i][0], to = ends[i][1];
+        if (distance[from] == INT_MAX) {
+            continue;
+        }
+        if (distance[from] + cost < distance[to]) {
+            distance[to] = distance[from] + cost;
+            pq_insert(pq, to);
+        } else if (distance[from] + cost == distance[to]) {
+            incremental_adopt(inc, to, from);
+        }
+    }
+
+    while (pq->size > 0) {
+        int from = pq_extract(pq);
+        path[from] = incremental_parent(inc, from);
+        inc->dirty[inc->num_dirty++] = from;
+        for (
+            int e = link_first(inc, from); e >= 0;
+            e = link_next(inc, from, e)
+        ) {
+            int to = link_target(inc, e), cost = *link_cost(inc, e);
+            if (cost < 0) {
+                continue;
+            }
+            int new_distance = distance[from] + cost;
+            if (new_distance < distance[to]) {
+                distance[to] = new_distance;
+                if (pq->position[to] < 0) {
+                    pq_insert(pq, to);
+                } else {
+                    pq_decrease(pq, to);
+                }
+            } else if (new_distance == distance[to] && pq->position[to] < 0) {
+                incremental_adopt(inc, to, from);
+            }
+        }
+    }
+}
+
+/**
+ * incremental_adopt(Incremental *inc, int v, int parent)
+ *
+ * Make parent the parent of v if it is on a shortest path to v and comes
+ * before the current parent
+ */
+void incremental_adopt(Incremental *inc, int v, int parent) {
+    int *distance = inc->sp->distance, *path = inc->sp->path;
+    if (v == inc->start || !key_less(distance, parent, v)) {
+        return;
+    }
+    if (path[v] < 0 || key_less(distance, parent, path[v])) {
+        path[v] = parent;
+        inc->dirty[inc->num_dirty++] = v;
+    }
+}
+
+/**
+ * incremental_parent(Incremental *inc, int v)
+ *
+ * Find the parent of v among its neighbors, all of which that come before
+ * v have their final distance
+ */
+int incremental_parent(Incremental *inc, int v) {
+    int *distance = inc->sp->distance;
+    int parent = -1;
+    if (v == inc->start || distance[v] == INT_MAX) {
+        return -1;
+    }
+
+    for (int e = link_first(inc, v); e >= 0; e = link_next(inc, v, e)) {
+        int u = link_target(inc, e), cost = *link_cost(inc, e);
+        if (
+            cost < 0 || distance[u] == INT_MAX
+            || distance[u] + cost != distance[v] || !key_less(distance, u, v)
+        ) {
+            continue;
+        }
+        if (parent < 0 || key_less(distance, u, parent)) {
+            parent = u;
+        }
+    }
+    return parent;
+}
+
+/**
+ * incremental_repair(Incremental *inc)
+ *
+ * Recompute first hops from the vertices whose parent changed, in settle
+ * order so a parent is always done before its children, and carry a change
+ * down into the subtree below
+ */
+void incremental_repair(Incremental *inc) {
+    PriorityQueue *pq = &inc->sp->pq;
+    int *path = inc->sp->path, *hop = inc->sp->hop;
+
+    for (int i = 0; i < inc->num_dirty; i++) {
+        if (pq->position[inc->dirty[i]] < 0) {
+            pq_insert(pq, inc->dirty[i]);
+        }
+    }
+    inc->num_dirty = 0;
+
+    while (pq->size > 0) {
+        int v = pq_extract(pq), parent = path[v];
+        int new_hop = parent < 0 ? -1 : parent == inc->start ? v : hop[parent];
+        if (new_hop == hop[v]) {
+            continue;
+        }
+        hop[v] = new_hop;
+        for (int e = link_first(inc, v); e >= 0; e = link_next(inc, v, e)) {
+            int child = link_target(inc, e);
+            if (path[child] == v && pq->position[child] < 0) {
+                pq_insert(pq, child);
+            }
+        }
+    }
+}
+
+/**
+ * incremental_settle(Incremental *inc)
+ *
+ * Redo every parent and first hop from the current distances, as
+ * settle_parents does for a topology. Over zero-cost links a change can
+ * reorder vertices at one distance far from it, so the repair above only
+ * holds while there are none.
+ */
+void incremental_settle(Incremental *inc) {
+    ShortestPaths *sp = inc->sp;
+    PriorityQueue *pq = &sp->pq;
+    int *distance = sp->distance, *path = sp->path, *hop = sp->hop;
+    bool *queued = sp->visited;
+    int n = inc->t->num_vertices;
+
+    for (int v = 0; v < n; v++) {
+        path[v] = -1;
+        hop[v] = -1;
+    }
+    inc->num_dirty = 0;
+    queued[inc->start] = true;
+    pq_insert(pq, inc->start);
+
+    while (pq->size > 0) {
+        int from = pq_extract(pq);
+        for (
+            int e = link_first(inc, from); e >= 0;
+            e = link_next(inc, from, e)
+        ) {
+            int to = link_target(inc, e), cost = *link_cost(inc, e);
+            if (
+                cost < 0 || queued[to]
+                || distance[from] + cost != distance[to]
+            ) {
+                continue;
+            }
+            queued[to] = true;
+            path[to] = from;
+            hop[to] = from == inc->start ? to : hop[from];
+            pq_insert(pq, to);
+        }
+    }
+
+    for (int v = 0; v < n; v++) {
+        queued[v] = false;
+    }
+}
+
+/**
+ * key_less(const int *distance, int a, int b)
+ *
+ * Whether a is settled before b: smaller distance, then smaller id
+ */
+bool key_less(const int *distance, int a, int b) {
+    return distance[a] < distance[b] || (distance[a] == distance[b] && a < b);
+}
+
+/**
+ * link_first(const Incremental *inc, int v)
+ *
+ * Links are numbered with the CSR slots first and the added links after
+ * them. Returns the first link of v, or -1 if it has none.
+ */
+int link_first(const Incremental *inc, int v) {
+    const Topology *t = inc->t;
+    if (t->offset[v] < t->offset[v + 1]) {
+        return t->offset[v];
+    }
+    return inc->extra_head[v] < 0 ? -1 : t->num_links + inc->extra_head[v];
+}
+
+int link_next(const Incremental *inc, int v, int e) {
+    const Topology *t = inc->t;
+    int next;
+    if (e < t->num_links) {
+        if (e + 1 < t->offset[v + 1]) {
+            return e + 1;
+        }
+        next = inc->extra_head[v];
+    } else {
+        next = inc->extra_next[e - t->num_links];
+    }
+    return next < 0 ? -1 : t->num_links + next;
+}
+
+int link_target(const Incremental *inc, int e) {
+    if (e < inc->t->num_links) {
+        return inc->t->target[e];
+    }
+    return inc->extra_target[e - inc->t->num_links];
+}
+
+int *link_cost(Incremental *inc, int e) {
+    if (e < inc->t->num_links) {
+        return &inc->t->cost[e];
+    }
+    return &inc->extra_cost[e - inc->t->num_links];
+}
+
+/**
+ * link_weight(Incremental *inc, int a, int b)
+ *
+ * Returns the cheapest working link between a and b, or INT_MAX if none
+ */
+int link_weight(Incremental *inc, int a, int b) {
+    int weight = INT_MAX;
+    for (int e = link_first(inc, a); e >= 0; e = link_next(inc, a, e)) {
+        int cost = *link_cost(inc, e);
+        if (link_target(inc, e) == b && cost >= 0 && cost < weight) {
+            weight = cost;
+        }
+    }
+    return weight;
+}
+
+void link_update(Incremental *inc, int a, int b, int cost) {
+    int ends[2][2] = {{a, b}, {b, a}};
+    bool found = false;
+
+    for (int i = 0; i < 2; i++) {
+        int from = ends[i][0], to = ends[i][1];
+        for (
+            int e = link_first(inc, from); e >= 0;
+            e = link_next(inc, from, e)
+        ) {
+            if (link_target(inc, e) == to) {
+                int *old = link_cost(inc, e);
+                inc->zero_links += (cost == 0) - (*old == 0);
+                *old = cost;
+                found = true;
+            }
+        }
+    }
+
+    if (found || cost < 0) {
+        return;
+    }
+
+    if (inc->num_extra + 2 > inc->extra_capacity) {
+        inc->extra_capacity = inc->num_extra ? 2 * inc->extra_capacity : 16;
+        size_t size = sizeof(int) * inc->extra_capacity;
+        inc->extra_next = realloc(inc->extra_next, size);
+        inc->extra_target = realloc(inc->extra_target, size);
+        inc->extra_cost = realloc(inc->extra_cost, size);
+    }
+
+    for (int i = 0; i < 2; i++) {
+        int from = ends[i][0], link = inc->num_extra++;
+        inc->extra_target[link] = ends[i][1];
+        inc->extra_cost[link] = cost;
+        inc->extra_next[link] = inc->extra_head[from];
+        inc->extra_head[from] = link;
+        inc->zero_links += cost == 0;
+    }
+}
+
+double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * bench_run(const char *name, Topology **cases, const int *sources, int n)
+ *
+ * Time every engine over the n cases, each from its own source, and check
+ * that the tables agree with the heap engine's
+ */
+void bench_run(const char *name, Topology **cases, const int *sources, int n) {
+    int max_vertices = 1;
+    long links = 0;
+    for (int i = 0; i < n; i++) {
+        if (cases[i]->num_vertices > max_vertices) {
+            max_vertices = cases[i]->num_vertices;
+        }
+        links += cases[i]->num_links / 2;
+    }
+
+    ShortestPaths *sp = sp_init(max_vertices);
+    int **expected = malloc(sizeof(int *) * (n > 0 ? n : 1));
+    for (int i = 0; i < n; i++) {
+        dijkstra(cases[i], sp, sources[i]);
+        expected[i] = malloc(sizeof(int) * 2 * (cases[i]->num_vertices + 1));
+        memcpy(expected[i], sp->distance, sizeof(int) * cases[i]->num_vertices);
+        memcpy(
+            expected[i] + cases[i]->num_vertices, sp->hop,
+            sizeof(int) * cases[i]->num_vertices
+        );
+    }
+
+    printf("%s: %d cases, %ld links", name, n, links);
+    for (int k = 0; k < NUM_ENGINES; k++) {
+        int reps = 0;
+        double start = bench_now(), elapsed = 0;
+        do {
+            for (int i = 0; i < n; i++) {
+                engines[k].run(cases[i], sp, sources[i]);
+            }
+            reps++;
+        } while ((elapsed = bench_now() - start) < BENCH_MIN_SECONDS);
+
+        bool same = true;
+        for (int i = 0; i < n && same; i++) {
+            int v = cases[i]->num_vertices;
+            engines[k].run(cases[i], sp, sources[i]);
+            same = memcmp(expected[i], sp->distance, sizeof(int) * v) == 0
+                && memcmp(expected[i] + v, sp->hop, sizeof(int) * v) == 0;
+        }
+        printf(
+            ", %s %.3f ms%s", engines[k].name, elapsed * 1e3 / reps,
+            same ? "" : " (MISMATCH)"
+        );
+    }
+    printf("\n");
+
+    for (int i = 0; i < n; i++) {
+        free(expected[i]);
+    }
+    free(expected);
+    sp_destroy(sp);
+}
+
+/**
+ * benchmark(int argc, char *argv[])
+ *
+ * route -b [-g vertices degree max_cost] [file ...]
+ *
+ * Time each engine over all cases of each input file, and over a random
+ * topology with the given size, average degree and largest cost
+ */
+int benchmark(int argc, char *argv[]) {
+    int vertices = 0, degree = 0, max_cost = 0, files = 0;
+
+    for (int i = 0; i < argc; i++) {
+        if (strcmp(argv[i], "-g") == 0 && i + 3 < argc) {
+            vertices = atoi(argv[++i]);
+            degree = atoi(argv[++i]);
+            max_cost = atoi(argv[++i]);
+            continue;
+        }
+
+        if (freopen(argv[i], "r", stdin) == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        files++;
+
+        int n, l, s, count = 0, capacity = 16;
+        Topology **cases = malloc(sizeof(Topology *) * capacity);
+        int *sources = malloc(sizeof(int) * capacity);
+        while (scanf("%d %d %d", &n, &l, &s) == 3) {
+            if (n == 0 && l == 0 && s == -1) {
+                break;
+            }
+            Topology *t = topology_read(n, l);
+            if (s < 0 || s >= n) {
+                topology_destroy(t);
+                continue;
+            }
+            if (count == capacity) {
+                capacity *= 2;
+                cases = realloc(cases, sizeof(Topology *) * capacity);
+                sources = realloc(sources, sizeof(int) * capacity);
+            }
+            cases[count] = t;
+            sources[count++] = s;
+        }
+
+        bench_run(argv[i], cases, sources, count);
+        for (int k = 0; k < count; k++) {
+            topology_destroy(cases[k]);
+        }
+        free(cases);
+        free(sources);
+    }
+
+    if (vertices == 0 && files == 0) {
+        vertices = 1 << 20;
+        degree = 8;
+        max_cost = 1000;
+    }
+
+    if (vertices > 0) {
+        if (degree < 1) {
+            degree = 1;
+        }
+        if (max_cost < 1) {
+            max_cost = 1;
+        }
+
+        char name[64];
+        Topology *t = topology_generate(vertices, degree, max_cost);
+        int source = 0;
+        snprintf(
+            name, sizeof(name), "random %d vertices, costs 1..%d",
+            vertices, max_cost
+        );
+        bench_run(name, &t, &source, 1);
+        topology_destroy(t);
+    }
+
+    return 0;
+}
+
+/**
+ * output_table(Output *out, const int *hop, int num_vertices)
+ *
+ * Write a routing table as "(h0,h1,...)", with -1 for the source itself and
+ * for unreachable vertices
+ */
+void output_table(Output *out, const int *hop, int num_vertices) {
+    output_char(out, '(');
+    for (int i = 0; i < num_vertices; i++) {
+        output_int(out, hop[i]);
+        if (i + 1 != num_vertices) {
+            output_char(out, ',');
+        }
+    }
+    output_char(out, ')');
+    output_char(out, '\n');
+}
+
+/**
+ * output_next_hops(Output *out, const NextHops *nh, int num_vertices)
+ *
+ * Write a multipath table like output_table, each entry listing its next
+ * hops in ascending order joined by '|'
+ */
+void output_next_hops(Output *out, const NextHops *nh, int num_vertices) {
+    output_char(out, '(');
+    for (int v = 0; v < num_vertices; v++) {
+        const uint64_t *set = nh->sets + (size_t) v * nh->words;
+        bool empty = true;
+        for (int w = 0; w < nh->words; w++) {
+            uint64_t bits = set[w];
+            while (bits) {
+                if (!empty) {
+                    output_char(out, '|');
+                }
+                output_int(out, nh->neighbor[w * 64 + __builtin_ctzll(bits)]);
+                bits &= bits - 1;
+                empty = false;
+            }
+        }
+        if (empty) {
+            output_int(out, -1);
+        }
+        if (v + 1 != num_vertices) {
+            output_char(out, ',');
+        }
+    }
+    output_char(out, ')');
+    output_char(out, '\n');
+}
+
+/**
+ * output_route(Output *out, int cost, const int *path, int length)
+ *
+ * Write a path and its cost as "cost (a,...,b)"
+ */
+void output_route(Output *out, int cost, const int *path, int length) {
+    output_int(out, cost);
+    output_char(out, ' ');
+    output_char(out, '(');
+    for (int i = 0; i < length; i++) {
+        output_int(out, path[i]);
+        if (i + 1 != length) {
+            output_char(out, ',');
+        }
+    }
+    output_char(out, ')');
+}
+
+void output_char(Output *out, char c) {
+    if (out->size == OUTPUT_BUFFER_SIZE) {
+        output_flush(out);
+    }
+    out->buffer[out->size++] = c;
+}
+
+void output_int(Output *out, int n) {
+    char digits[12];
+    int len = 0;
+    unsigned int u = n < 0 ? -(unsigned int) n : (unsigned int) n;
+
+    do {
+        digits[len++] = (char) ('0' + u % 10);
+        u /= 10;
+    } while (u > 0);
+
+    if (n < 0) {
+        digits[len++] = '-';
+    }
+
+    if (out->size + len > OUTPUT_BUFFER_SIZE) {
+        output_flush(out);
+    }
+    while (len > 0) {
+        out->buffer[out->size++] = digits[--len];
+    }
+}
+
+void output_flush(Output *out) {
+    fwrite(out->buffer, 1, out->size, stdout);
+    out->size = 0;
+}
+
+void pq_insert(PriorityQueue *pq, int vertex) {
+    if (pq->size >= pq->capacity) {
+        return;
+    }
+    pq->heap[pq->size] = vertex;
+    pq->position[vertex] = pq->size;
+    pq->size++;
+    sift_up(pq, pq->size - 1);
+}
+
+/**
+ * pq_decrease(PriorityQueue *pq, int vertex)
+ *
+ * Restore the heap after the distance of a queued vertex went down
+ */
+void pq_decrease(PriorityQueue *pq, int vertex) {
+    sift_up(pq, pq->position[vertex]);
+}
+
+int pq_extract(PriorityQueue *pq) {
+    if (pq->size == 0) {
+        return -1;
+    }
+
+    int vertex = pq->heap[0];
+    pq->position[vertex] = -1;
+    pq->size--;
+    if (pq->size > 0) {
+        pq->heap[0] = pq->heap[pq->size];
+        pq->position[pq->heap[0]] = 0;
+        sift_down(pq, 0);
+    }
+    return vertex;
+}
+
+void sift_up(PriorityQueue *pq, int i) {
+    int vertex = pq->heap[i];
+    while (i > 0) {
+        int parent = (i - 1) / PQ_ARITY;
+        if (check_order(pq, pq->heap[parent], vertex) != 1) {
+            break;
+        }
+        pq->heap[i] = pq->heap[parent];
+        pq->position[pq->heap[i]] = i;
+        i = parent;
+    }
+    pq->heap[i] = vertex;
+    pq->position[vertex] = i;
+}
+
+void sift_down(PriorityQueue *pq, int i) {
+    int vertex = pq->heap[i];
+    while (1) {
+        int first = i * PQ_ARITY + 1;
+        if (first >= pq->size) {
+            break;
+        }
+
+        int last = first + PQ_ARITY < pq->size ? first + PQ_ARITY : pq->size;
+        int child = first;
+        for (int c = first + 1; c < last; c++) {
+            if (check_order(pq, pq->heap[child], pq->heap[c]) == 1) {
+                child = c;
+            }
+        }
+
+        if (check_order(pq, vertex, pq->heap[child]) != 1) {
+            break;
+        }
+        pq->heap[i] = pq->heap[child];
+        pq->position[pq->heap[i]] = i;
+        i = child;
+    }
+    pq->heap[i] = vertex;
+    pq->position[vertex] = i;
+}
+
+/**
+ * check_order(PriorityQueue *pq, int a, int b)
+ *
+ * Compare two queued vertices and determine which should be closer to the
+ * root. Equal distances go to the lower vertex id.
+ *
+ * Returns 1 if b should be root and -1 if a should be root
+ */
+int check_order(PriorityQueue *pq, int a, int b) {
+    int a_distance = pq->distance[a],
+        b_distance = pq->distance[b];
+
+    if (b_distance < a_distance || (b_distance == a_distance && b < a)) {
         return 1;
     }
 
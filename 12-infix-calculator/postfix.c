@@ -1,125 +1,289 @@
 #include <ctype.h>
 #include <limits.h>
 #include <math.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
-#define DIGIT_LENGTH 9
+#define VALUE_STACK_SIZE 256
+// Input is read in blocks at least this big; a line longer than a block
+// grows it
+#define INPUT_BLOCK_SIZE (1 << 20)
+// Lines a thread takes at a time end after about this many bytes
+#define CHUNK_BYTES (16 << 10)
+// Longest text format_result writes, the largest double with a newline
+#define RESULT_LENGTH 320
+// Results the cache keeps when only a cache file is given
+#define CACHE_ENTRIES (1 << 16)
+#define CACHE_MAGIC "PXC1"
+// Decimal exponents with a 128-bit power of five in powers_of_five, for
+// numbers of up to 19 significant digits; strtod takes the rest
+#define SMALLEST_POWER_OF_FIVE -64
+#define LARGEST_POWER_OF_FIVE 64
+// Rows run_columns takes each operator across at a time, a whole number of
+// vectors
+#define BLOCK_ROWS 256
+#define VECTOR_BYTES 32
+#define VECTOR_LANES (VECTOR_BYTES / (int) sizeof(double))
+// Values shared between parts of an expression kept at once
+#define TEMP_SLOTS 64
+// Largest whole exponent turned into multiplications
+#define MAX_POWER 8
+#define OP_CONSTANT 'k'
+#define OP_VARIABLE 'v'
+#define OP_STORE 's'
+#define OP_LOAD 'l'
 
 typedef struct OperatorNode {
     char data;
     struct OperatorNode *next;
 } OperatorNode;
 
-typedef struct N {
-    double value;
-    struct N *next;
-} N;
-
 typedef struct OperatorStack {
     OperatorNode *head;
 } OperatorStack;
 
-typedef struct Numbers {
-    N *head;
-} Numbers;
+// A value in the expression DAG: an operator on nodes a and b, a constant,
+// or variable a. Identical nodes are shared through a hash table chained
+// by next.
+typedef struct Node {
+    int op;
+    int a;
+    int b;
+    double value;
+    int uses;
+    int slot;
+    unsigned hash;
+    int next;
+} Node;
+
+// An expression compiled to postfix: operator characters, OP_CONSTANT
+// followed by an index into constants for every number, OP_VARIABLE
+// followed by an index into names for every identifier, and OP_STORE and
+// OP_LOAD followed by a temp slot for values used more than once
+typedef struct Program {
+    int *code;
+    int size;
+    int capacity;
+    double *constants;
+    int num_constants;
+    int constants_capacity;
+    char **names;
+    int num_variables;
+    int names_capacity;
+    int num_temps;
+    int max_depth;
+    // Compilation scratch: the DAG and the nodes of the values parsed so far
+    Node *nodes;
+    int num_nodes;
+    int nodes_capacity;
+    int *buckets;
+    int *values;
+    int depth;
+    int values_capacity;
+    int valid;
+} Program;
+
+// Lines are handed out in place, each ending in '\n' or, for the last, the
+// '\0' kept after the data
+typedef struct Input {
+    char *buffer;
+    size_t size;
+    size_t position;
+    size_t capacity;
+    int eof;
+} Input;
+
+// The result of a line seen before, keyed by the line with everything
+// compile skips dropped and every number replaced by its bits. Entries are
+// chained in hash buckets by next and in order of use by newer and older.
+typedef struct Entry {
+    char *key;
+    int length;
+    uint64_t hash;
+    double result;
+    int ok;
+    int next;
+    int newer;
+    int older;
+} Entry;
+
+typedef struct Cache {
+    Entry *entries;
+    int size;
+    int capacity;
+    int *buckets;
+    int mask;
+    int newest;
+    int oldest;
+    long hits;
+    long misses;
+} Cache;
+
+// A line of a chunk not in the cache, with its key at key in the chunk
+typedef struct Miss {
+    size_t key;
+    int length;
+    uint64_t hash;
+    double result;
+    int ok;
+} Miss;
+
+// A run of whole lines of input and the results they print. With a cache,
+// lines holds the entry each line was found in, or -1 minus its miss; a
+// line repeated within the chunk shares the miss of its first time, found
+// through the open addressing table seen.
+typedef struct Chunk {
+    char *start;
+    char *end;
+    char *output;
+    size_t size;
+    size_t capacity;
+    int *lines;
+    int num_lines;
+    int lines_capacity;
+    Miss *misses;
+    int num_misses;
+    int misses_capacity;
+    char *keys;
+    size_t keys_size;
+    size_t keys_capacity;
+    int *seen;
+    int seen_capacity;
+} Chunk;
+
+// The chunks of the block of input being evaluated, taken in turn by the
+// threads, each compiling into its own Program. The cache is only read
+// while they run.
+typedef struct Batch {
+    Cache *cache;
+    Chunk *chunks;
+    int num_chunks;
+    int capacity;
+    atomic_int next;
+    int done;
+    pthread_barrier_t start;
+    pthread_barrier_t finish;
+} Batch;
+
+// Doubles operated on together; only aligned like a double so a vector can
+// start anywhere in a column
+typedef double Vector
+    __attribute__((vector_size(VECTOR_BYTES), aligned(sizeof(double))));
 
 void push(OperatorStack *, char);
 char pop(OperatorStack *);
 char peek(OperatorStack *);
 void empty(OperatorStack *);
 
-void push_n(Numbers *, double);
-double pop_n(Numbers *);
-void empty_n(Numbers *);
-
 int icp(char);
 int isp(char);
 
-void evaluate(Numbers *, char);
-
-int main(int argc, char *argv[]) {
-    char c;
-    OperatorStack *operators = malloc(sizeof(OperatorStack));
-    operators->head = NULL;
+void input_init(Input *);
+void input_free(Input *);
+void input_fill(Input *);
+char *next_line(Input *);
+char *next_lines(Input *, size_t *);
 
-    Numbers *numbers = malloc(sizeof(Numbers));
-    numbers->head = NULL;
+double scan_number(char **);
+int eisel_lemire(uint64_t, int, double *);
 
-    char *digits = malloc(DIGIT_LENGTH + 1);
-    char *d = digits;
+void program_init(Program *);
+void program_free(Program *);
+int compile(Program *, char *);
+void emit(Program *, char);
+void emit_constant(Program *, double);
+void emit_variable(Program *, const char *, int);
+void emit_node(Program *, int);
+int node(Program *, int, int, int, double);
+int operate(Program *, int, int, int);
+int power(Program *, int, int);
+void generate(Program *, int);
+void append(Program *, int, int);
+void dump(const Program *);
+double apply(int, double, double);
+int run(const Program *, const double *, double *);
+void run_columns(const Program *, double **, int, double *);
+int evaluate_columns(void);
+void evaluate_lines(int, Cache *);
+int evaluate(Program *, char *, double *);
+void batch_run(Batch *, Program *);
+void batch_record(Batch *);
+int chunk_find(const Chunk *, const char *, int, uint64_t);
+void chunk_remember(Chunk *, int);
+void *batch_worker(void *);
+char *format_result(char *, double);
 
-    int num_cases = 0;
-    scanf("%d\n", &num_cases);
+int normalize(char *, char *);
+uint64_t fnv1a(const char *, int);
+void cache_init(Cache *, int);
+void cache_free(Cache *);
+int cache_find(const Cache *, const char *, int, uint64_t);
+void cache_use(Cache *, int);
+int cache_add(Cache *, const char *, int, uint64_t, double, int);
+int cache_load(Cache *, const char *);
+int cache_save(const Cache *, const char *);
 
-    while ((c = getchar()) != EOF) {
-        if (operators->head == NULL) {
-            push(operators, '(');
-        }
+extern const uint64_t powers_of_five[][2];
+extern const double powers_of_ten[];
 
-        if (isdigit(c) || c == '.') {
-            *d = c;
-            d++;
+int main(int argc, char *argv[]) {
+    int threads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+    int entries = 0;
+    char *cache_file = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-v") == 0) {
+            return evaluate_columns();
+        } else if (strcmp(argv[i], "-t") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-C") == 0 && i + 1 < argc) {
+            entries = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "-c") == 0 && i + 1 < argc) {
+            cache_file = argv[++i];
         } else {
-            *d = '\0';
-            double n = 0;
-
-            // We parsed a digit!
-            if (d != digits) {
-                n = atof(digits);
-                // Reset the digit pointer
-                d = digits;
-                #if POSTFIX
-                    printf("{%f}", n);
-                #endif
-                push_n(numbers, n);
-            }
-
-            if (strchr("+-*/^()\n", c) != NULL) {
-                char o;
-                if (c == '(') {
-                    push(operators, c);
-                } else if (c == ')' || c == '\n') {
-                    while ((o = pop(operators)) != '(') {
-                        #if POSTFIX
-                            printf("%c", o);
-                        #endif
-                        evaluate(numbers, o);
-                    }
-                } else {
-                    while (icp(c) < isp(peek(operators))) {
-                        o = pop(operators);
-                        #if POSTFIX
-                            printf("%c", o);
-                        #endif
-                        evaluate(numbers, o);
-                    }
-                    push(operators, c);
-                }
-
-                if (c == '\n') {
-                    double result = pop_n(numbers);
-                    if (result != EOF) {
-                        printf("%.4f\n", result);
-                    }
-                    empty_n(numbers);
-                    empty(operators);
-                }
-            }
+            fprintf(
+                stderr,
+                "usage: %s [-t threads] [-C entries] [-c cache] [-v]\n",
+                argv[0]
+            );
+            return 1;
         }
     }
+    if (threads < 1) {
+        threads = 1;
+    }
+    if (cache_file != NULL && entries <= 0) {
+        entries = CACHE_ENTRIES;
+    }
 
-    free(digits);
+    if (entries <= 0) {
+        evaluate_lines(threads, NULL);
+        return 0;
+    }
 
-    empty_n(numbers);
-    free(numbers);
+    Cache cache;
+    cache_init(&cache, entries);
+    if (cache_file != NULL) {
+        cache_load(&cache, cache_file);
+    }
 
-    empty(operators);
-    free(operators);
+    evaluate_lines(threads, &cache);
+    fprintf(
+        stderr, "cache: %ld hits, %ld misses, %d entries\n",
+        cache.hits, cache.misses, cache.size
+    );
 
-    // We cool? We cool.
-    return 0;
+    int status = 0;
+    if (cache_file != NULL && !cache_save(&cache, cache_file)) {
+        fprintf(stderr, "could not write %s\n", cache_file);
+        status = 1;
+    }
+    cache_free(&cache);
+    return status;
 }
 
 int icp(char operator) {
@@ -154,41 +318,6 @@ int isp(char operator) {
     }
 }
 
-void evaluate(Numbers *n, char op) {
-    double b = pop_n(n);
-    double a = pop_n(n);
-    if (a == EOF || b == EOF) {
-        return;
-    }
-
-    if (op == '+') {
-        push_n(n, a + b);
-        #if DEBUG
-            printf("%f %c %f = %f\n", a, op, b, a + b);
-        #endif
-    } else if (op == '-') {
-        push_n(n, a - b);
-        #if DEBUG
-            printf("%f %c %f = %f\n", a, op, b, a - b);
-        #endif
-    } else if (op == '*') {
-        push_n(n, a * b);
-        #if DEBUG
-            printf("%f %c %f = %f\n", a, op, b, a * b);
-        #endif
-    } else if (op == '/') {
-        push_n(n, a / b);
-        #if DEBUG
-            printf("%f %c %f = %f\n", a, op, b, a / b);
-        #endif
-    } else if (op == '^') {
-        push_n(n, pow(a, b));
-        #if DEBUG
-            printf("%f %c %f = %f\n", a, op, b, pow(a, b));
-        #endif
-    }
-}
-
 void push(OperatorStack *stack, char c) {
     OperatorNode *node = malloc(sizeof(OperatorNode));
 
@@ -225,30 +354,1530 @@ void empty(OperatorStack *stack) {
     }
 }
 
-void push_n(Numbers *stack, double n) {
-    N *node = malloc(sizeof(N));
+void input_init(Input *input) {
+    input->capacity = INPUT_BLOCK_SIZE + 1;
+    input->buffer = malloc(input->capacity);
+    input->buffer[0] = '\0';
+    input->size = 0;
+    input->position = 0;
+    input->eof = 0;
+}
 
-    node->value = n;
-    node->next = stack->head;
+void input_free(Input *input) {
+    free(input->buffer);
+}
 
-    stack->head = node;
+// Keep the unread part of the buffer and read the next block after it
+void input_fill(Input *input) {
+    size_t rest = input->size - input->position;
+    memmove(input->buffer, input->buffer + input->position, rest);
+    input->size = rest;
+    input->position = 0;
+    if (input->capacity - 1 - rest < INPUT_BLOCK_SIZE) {
+        input->capacity = 2 * (input->capacity - 1) + 1;
+        input->buffer = realloc(input->buffer, input->capacity);
+    }
+
+    size_t read = fread(
+        input->buffer + rest, 1, input->capacity - 1 - rest, stdin
+    );
+    input->size += read;
+    input->buffer[input->size] = '\0';
+    input->eof = read == 0;
 }
 
-double pop_n(Numbers *stack) {
-    double n;
-    if (stack->head == NULL) {
-        return EOF;
+char *next_line(Input *input) {
+    for (;;) {
+        char *start = input->buffer + input->position;
+        char *end = memchr(start, '\n', input->size - input->position);
+        if (end != NULL) {
+            input->position = end + 1 - input->buffer;
+            return start;
+        }
+        if (input->eof) {
+            if (input->position == input->size) {
+                return NULL;
+            }
+            input->position = input->size;
+            return start;
+        }
+        input_fill(input);
     }
+}
 
-    N *tmp = stack->head;
-    stack->head = stack->head->next;
-    n = tmp->value;
-    free(tmp);
-    return n;
+// Hand out every whole line left in the buffer at once, reading a block
+// first if there are none
+char *next_lines(Input *input, size_t *length) {
+    for (;;) {
+        char *start = input->buffer + input->position;
+        char *end = input->buffer + input->size;
+        if (!input->eof) {
+            while (end > start && end[-1] != '\n') {
+                end--;
+            }
+        }
+        if (end > start) {
+            *length = end - start;
+            input->position += *length;
+            return start;
+        }
+        if (input->eof) {
+            return NULL;
+        }
+        input_fill(input);
+    }
 }
 
-void empty_n(Numbers *stack) {
-    while (stack->head != NULL) {
-        pop_n(stack);
+// Convert the number at *cursor, digits with an optional fraction and
+// exponent, and move the cursor past it. Up to 19 significant digits are
+// exact in an integer; then the value is either that integer times an
+// exact power of ten, or found by Eisel and Lemire's method. Anything else
+// goes to strtod.
+double scan_number(char **cursor) {
+    char *c = *cursor, *start = c;
+    uint64_t w = 0;
+    int digits = 0, q = 0, truncated = 0;
+
+    while (*c == '0') {
+        c++;
+    }
+    for (; isdigit(*c); c++) {
+        if (digits < 19) {
+            w = 10 * w + (*c - '0');
+            digits += w > 0;
+        } else {
+            truncated |= *c != '0';
+            q++;
+        }
+    }
+    if (*c == '.') {
+        for (c++; isdigit(*c); c++) {
+            if (digits < 19) {
+                w = 10 * w + (*c - '0');
+                digits += w > 0;
+                q--;
+            } else if (*c != '0') {
+                truncated = 1;
+            }
+        }
+    }
+
+    if (*c == 'e' || *c == 'E') {
+        char *e = c + 1;
+        int sign = 1, exponent = 0;
+        if (*e == '-' || *e == '+') {
+            sign = *e++ == '-' ? -1 : 1;
+        }
+        if (isdigit(*e)) {
+            for (; isdigit(*e); e++) {
+                if (exponent < 100000) {
+                    exponent = 10 * exponent + (*e - '0');
+                }
+            }
+            q += sign * exponent;
+            c = e;
+        }
+    }
+    *cursor = c;
+
+    double value;
+    if (w == 0 && !truncated) {
+        return 0;
+    }
+    if (!truncated && w <= (1ULL << 53) && q >= -22 && q <= 22) {
+        return q < 0 ? (double) w / powers_of_ten[-q]
+            : (double) w * powers_of_ten[q];
+    }
+    if (!truncated && eisel_lemire(w, q, &value)) {
+        return value;
+    }
+
+    // Terminate the number in place for strtod
+    char saved = *c;
+    *c = '\0';
+    value = strtod(start, NULL);
+    *c = saved;
+    return value;
+}
+
+// Round w * 10^q to the nearest double from the 128-bit power of five of
+// q. Fails outside the table and for subnormal or infinite results.
+int eisel_lemire(uint64_t w, int q, double *value) {
+    if (q < SMALLEST_POWER_OF_FIVE || q > LARGEST_POWER_OF_FIVE) {
+        return 0;
+    }
+
+    int lz = __builtin_clzll(w);
+    w <<= lz;
+
+    const uint64_t *power = powers_of_five[q - SMALLEST_POWER_OF_FIVE];
+    unsigned __int128 product = (unsigned __int128) w * power[0];
+    uint64_t high = product >> 64, low = (uint64_t) product;
+
+    // Only when the bits past the mantissa are all ones can the lower half
+    // of the power still carry into them
+    if ((high & 0x1FF) == 0x1FF) {
+        uint64_t carry = ((unsigned __int128) w * power[1]) >> 64;
+        low += carry;
+        high += carry > low;
+    }
+
+    int upper = high >> 63;
+    uint64_t mantissa = high >> (upper + 9);
+    int power2 = (((152170 + 65536) * q) >> 16) + 63 + upper - lz + 1023;
+    if (power2 <= 0) {
+        return 0;
+    }
+
+    // Exactly halfway between two doubles rounds to the even one
+    if (
+        low <= 1 && q >= -4 && q <= 23 && (mantissa & 3) == 1
+        && (mantissa << (upper + 9)) == high
+    ) {
+        mantissa &= ~1ULL;
+    }
+
+    mantissa += mantissa & 1;
+    mantissa >>= 1;
+    if (mantissa >= (2ULL << 52)) {
+        mantissa = 1ULL << 52;
+        power2++;
+    }
+    if (power2 >= 0x7FF) {
+        return 0;
+    }
+
+    uint64_t bits = (mantissa & ~(1ULL << 52)) | (uint64_t) power2 << 52;
+    memcpy(value, &bits, sizeof(*value));
+    return 1;
+}
+
+void program_init(Program *program) {
+    program->capacity = 64;
+    program->code = malloc(sizeof(int) * program->capacity);
+    program->constants_capacity = 32;
+    program->constants = malloc(sizeof(double) * program->constants_capacity);
+    program->names_capacity = 8;
+    program->names = malloc(sizeof(char *) * program->names_capacity);
+    program->nodes_capacity = 64;
+    program->nodes = malloc(sizeof(Node) * program->nodes_capacity);
+    program->buckets = malloc(sizeof(int) * 2 * program->nodes_capacity);
+    program->values_capacity = 64;
+    program->values = malloc(sizeof(int) * program->values_capacity);
+    program->size = 0;
+    program->num_constants = 0;
+    program->num_variables = 0;
+    program->num_temps = 0;
+    program->valid = 0;
+}
+
+void program_free(Program *program) {
+    for (int i = 0; i < program->num_variables; i++) {
+        free(program->names[i]);
+    }
+    free(program->names);
+    free(program->code);
+    free(program->constants);
+    free(program->nodes);
+    free(program->buckets);
+    free(program->values);
+}
+
+int compile(Program *program, char *line) {
+    OperatorStack operators = { NULL };
+    char o;
+
+    for (int i = 0; i < program->num_variables; i++) {
+        free(program->names[i]);
+    }
+    program->num_variables = 0;
+    program->num_nodes = 0;
+    program->depth = 0;
+    program->valid = 1;
+    memset(program->buckets, -1, sizeof(int) * 2 * program->nodes_capacity);
+
+    push(&operators, '(');
+    for (char *c = line; *c != '\0' && *c != '\n'; c++) {
+        if (isdigit(*c) || *c == '.') {
+            emit_constant(program, scan_number(&c));
+            c--;
+        } else if (isalpha(*c) || *c == '_') {
+            char *end = c;
+            while (isalnum(*end) || *end == '_') {
+                end++;
+            }
+            emit_variable(program, c, end - c);
+            c = end - 1;
+        } else if (*c == '(') {
+            push(&operators, *c);
+        } else if (*c == ')') {
+            while ((o = pop(&operators)) != '(') {
+                emit(program, o);
+            }
+            if (operators.head == NULL) {
+                push(&operators, '(');
+            }
+        } else if (strchr("+-*/^", *c) != NULL) {
+            while (icp(*c) < isp(peek(&operators))) {
+                emit(program, pop(&operators));
+            }
+            push(&operators, *c);
+        }
+    }
+
+    while ((o = pop(&operators)) != EOF) {
+        if (o != '(') {
+            emit(program, o);
+        }
+    }
+
+    #if POSTFIX
+        printf("\n");
+    #endif
+
+    if (!program->valid || program->depth == 0) {
+        return 0;
+    }
+
+    generate(program, program->values[program->depth - 1]);
+    #if DEBUG
+        dump(program);
+    #endif
+    return program->max_depth <= VALUE_STACK_SIZE;
+}
+
+void emit(Program *program, char op) {
+    #if POSTFIX
+        printf("%c", op);
+    #endif
+
+    // An operator short of operands drops the whole expression
+    if (program->depth < 2) {
+        program->valid = 0;
+        return;
     }
+
+    int b = program->values[--program->depth];
+    int a = program->values[--program->depth];
+    emit_node(program, operate(program, op, a, b));
+}
+
+void emit_constant(Program *program, double n) {
+    #if POSTFIX
+        printf("{%f}", n);
+    #endif
+
+    emit_node(program, node(program, OP_CONSTANT, -1, -1, n));
+}
+
+void emit_variable(Program *program, const char *name, int length) {
+    int index = 0;
+    while (
+        index < program->num_variables
+        && (
+            strncmp(program->names[index], name, length) != 0
+            || program->names[index][length] != '\0'
+        )
+    ) {
+        index++;
+    }
+
+    if (index == program->num_variables) {
+        if (program->num_variables == program->names_capacity) {
+            program->names_capacity *= 2;
+            program->names = realloc(
+                program->names, sizeof(char *) * program->names_capacity
+            );
+        }
+        program->names[program->num_variables++] = strndup(name, length);
+    }
+
+    #if POSTFIX
+        printf("{%s}", program->names[index]);
+    #endif
+
+    emit_node(program, node(program, OP_VARIABLE, index, -1, 0));
+}
+
+void emit_node(Program *program, int n) {
+    if (program->depth == program->values_capacity) {
+        program->values_capacity *= 2;
+        program->values = realloc(
+            program->values, sizeof(int) * program->values_capacity
+        );
+    }
+    program->values[program->depth++] = n;
 }
+
+// The node for op on a and b, value for a constant, reusing an identical
+// one if there is one. Nodes only refer to nodes made before them.
+int node(Program *program, int op, int a, int b, double value) {
+    unsigned long long bits;
+    memcpy(&bits, &value, sizeof(bits));
+    bits ^= bits >> 32;
+    unsigned hash = (unsigned) op;
+    hash = (hash * 1000003) ^ (unsigned) a;
+    hash = (hash * 1000003) ^ (unsigned) b;
+    hash = (hash * 1000003) ^ (unsigned) bits;
+    hash ^= hash >> 15;
+
+    unsigned mask = 2 * program->nodes_capacity - 1;
+    for (int i = program->buckets[hash & mask]; i >= 0; ) {
+        Node *x = &program->nodes[i];
+        if (
+            x->op == op && x->a == a && x->b == b
+            && memcmp(&x->value, &value, sizeof(value)) == 0
+        ) {
+            return i;
+        }
+        i = x->next;
+    }
+
+    if (program->num_nodes == program->nodes_capacity) {
+        program->nodes_capacity *= 2;
+        program->nodes = realloc(
+            program->nodes, sizeof(Node) * program->nodes_capacity
+        );
+        program->buckets = realloc(
+            program->buckets, sizeof(int) * 2 * program->nodes_capacity
+        );
+
+        // Rehash into the doubled table
+        mask = 2 * program->nodes_capacity - 1;
+        memset(program->buckets, -1, sizeof(int) * (mask + 1));
+        for (int i = 0; i < program->num_nodes; i++) {
+            Node *x = &program->nodes[i];
+            x->next = program->buckets[x->hash & mask];
+            program->buckets[x->hash & mask] = i;
+        }
+    }
+
+    int i = program->num_nodes++;
+    Node *x = &program->nodes[i];
+    x->op = op;
+    x->a = a;
+    x->b = b;
+    x->value = value;
+    x->hash = hash;
+    x->next = program->buckets[hash & mask];
+    program->buckets[hash & mask] = i;
+    return i;
+}
+
+// op on a and b, folded if both are constants; a power with a small whole
+// exponent becomes multiplications
+int operate(Program *program, int op, int a, int b) {
+    Node *x = &program->nodes[a], *y = &program->nodes[b];
+    if (x->op == OP_CONSTANT && y->op == OP_CONSTANT) {
+        double value = apply(op, x->value, y->value);
+        return node(program, OP_CONSTANT, -1, -1, value);
+    }
+
+    if (
+        op == '^' && y->op == OP_CONSTANT && y->value >= 0
+        && y->value <= MAX_POWER && y->value == floor(y->value)
+    ) {
+        return power(program, a, (int) y->value);
+    }
+    return node(program, op, a, b, 0);
+}
+
+// a to the n by repeated squaring
+int power(Program *program, int a, int n) {
+    if (n == 0) {
+        return node(program, OP_CONSTANT, -1, -1, 1);
+    }
+    if (n == 1) {
+        return a;
+    }
+
+    int half = power(program, a, n / 2);
+    int square = node(program, '*', half, half, 0);
+    return n % 2 ? node(program, '*', square, a, 0) : square;
+}
+
+// Write the code for root. Operators used more than once are stored in a
+// temp slot the first time and loaded after, the slot freed again after
+// its last load.
+void generate(Program *program, int root) {
+    Node *nodes = program->nodes;
+    for (int i = 0; i <= root; i++) {
+        nodes[i].uses = 0;
+        nodes[i].slot = -1;
+    }
+
+    // Operands always come before what uses them
+    nodes[root].uses = 1;
+    for (int i = root; i >= 0; i--) {
+        if (
+            nodes[i].uses > 0
+            && nodes[i].op != OP_CONSTANT && nodes[i].op != OP_VARIABLE
+        ) {
+            nodes[nodes[i].a].uses++;
+            nodes[nodes[i].b].uses++;
+        }
+    }
+
+    int free_slots[TEMP_SLOTS], num_free = TEMP_SLOTS;
+    for (int i = 0; i < TEMP_SLOTS; i++) {
+        free_slots[i] = TEMP_SLOTS - 1 - i;
+    }
+
+    int *work = program->values, top = 0, depth = 0;
+    program->size = 0;
+    program->num_constants = 0;
+    program->num_temps = 0;
+    program->max_depth = 0;
+    work[top++] = root;
+    while (top > 0) {
+        int w = work[--top];
+        Node *x = &nodes[w < 0 ? ~w : w];
+
+        if (w < 0) {
+            append(program, x->op, -1);
+            depth--;
+            if (x->uses > 1 && num_free > 0) {
+                x->slot = free_slots[--num_free];
+                if (x->slot >= program->num_temps) {
+                    program->num_temps = x->slot + 1;
+                }
+                append(program, OP_STORE, x->slot);
+                x->uses--;
+            }
+            continue;
+        }
+
+        if (x->slot >= 0) {
+            append(program, OP_LOAD, x->slot);
+            // A node recomputed for want of a slot references its operands
+            // more often than counted, so a freed slot is forgotten and the
+            // value computed again
+            if (--x->uses == 0) {
+                free_slots[num_free++] = x->slot;
+                x->slot = -1;
+            }
+        } else if (x->op == OP_CONSTANT) {
+            if (program->num_constants == program->constants_capacity) {
+                program->constants_capacity *= 2;
+                program->constants = realloc(
+                    program->constants,
+                    sizeof(double) * program->constants_capacity
+                );
+            }
+            program->constants[program->num_constants] = x->value;
+            append(program, OP_CONSTANT, program->num_constants++);
+        } else if (x->op == OP_VARIABLE) {
+            append(program, OP_VARIABLE, x->a);
+        } else {
+            if (top + 3 > program->values_capacity) {
+                program->values_capacity *= 2;
+                work = program->values = realloc(
+                    work, sizeof(int) * program->values_capacity
+                );
+            }
+            work[top++] = ~w;
+            work[top++] = x->b;
+            work[top++] = x->a;
+            continue;
+        }
+
+        if (++depth > program->max_depth) {
+            program->max_depth = depth;
+        }
+    }
+}
+
+// Append an instruction, with its operand unless that is -1
+void append(Program *program, int op, int operand) {
+    if (program->size + 2 > program->capacity) {
+        program->capacity *= 2;
+        program->code = realloc(program->code, sizeof(int) * program->capacity);
+    }
+
+    program->code[program->size++] = op;
+    if (operand >= 0) {
+        program->code[program->size++] = operand;
+    }
+}
+
+void dump(const Program *program) {
+    for (int i = 0; i < program->size; i++) {
+        int op = program->code[i];
+        if (op == OP_CONSTANT) {
+            printf("push %f\n", program->constants[program->code[++i]]);
+        } else if (op == OP_VARIABLE) {
+            printf("push %s\n", program->names[program->code[++i]]);
+        } else if (op == OP_STORE) {
+            printf("store t%d\n", program->code[++i]);
+        } else if (op == OP_LOAD) {
+            printf("push t%d\n", program->code[++i]);
+        } else {
+            printf("%c\n", op);
+        }
+    }
+}
+
+double apply(int op, double a, double b) {
+    switch (op) {
+        case '+':
+            return a + b;
+        case '-':
+            return a - b;
+        case '*':
+            return a * b;
+        case '/':
+            return a / b;
+        default:
+            return pow(a, b);
+    }
+}
+
+int run(const Program *program, const double *variables, double *result) {
+    double stack[VALUE_STACK_SIZE];
+    double temps[TEMP_SLOTS];
+    int top = 0;
+
+    for (int i = 0; i < program->size; i++) {
+        int op = program->code[i];
+        if (op == OP_CONSTANT) {
+            stack[top++] = program->constants[program->code[++i]];
+            continue;
+        }
+        if (op == OP_VARIABLE) {
+            stack[top++] = variables[program->code[++i]];
+            continue;
+        }
+        if (op == OP_STORE) {
+            temps[program->code[++i]] = stack[top - 1];
+            continue;
+        }
+        if (op == OP_LOAD) {
+            stack[top++] = temps[program->code[++i]];
+            continue;
+        }
+
+        double b = stack[--top];
+        double a = stack[top - 1];
+        double value = apply(op, a, b);
+        #if DEBUG
+            printf("%f %c %f = %f\n", a, op, b, value);
+        #endif
+        stack[top - 1] = value;
+    }
+
+    if (top == 0) {
+        return 0;
+    }
+    *result = stack[top - 1];
+    return 1;
+}
+
+// Evaluate program for every row of columns, one column per variable, a
+// block of rows at a time so every operator runs as a loop over vectors.
+// Variables are read from their columns in place except in a last, partial
+// block, which is padded out to whole vectors.
+void run_columns(
+    const Program *program, double **columns, int rows, double *results
+) {
+    const double **operands = malloc(sizeof(double *) * program->max_depth);
+    double *slots = malloc(sizeof(double) * BLOCK_ROWS * program->max_depth);
+    double *temps = malloc(
+        sizeof(double) * BLOCK_ROWS * (program->num_temps + 1)
+    );
+
+    for (int first = 0; first < rows; first += BLOCK_ROWS) {
+        int count = rows - first < BLOCK_ROWS ? rows - first : BLOCK_ROWS;
+        int vectors = (count + VECTOR_LANES - 1) / VECTOR_LANES;
+        int top = 0;
+
+        for (int i = 0; i < program->size; i++) {
+            int op = program->code[i];
+            double *slot = slots + (size_t) top * BLOCK_ROWS;
+            if (op == OP_CONSTANT) {
+                double constant = program->constants[program->code[++i]];
+                Vector n = (Vector) { 0 } + constant;
+                for (int j = 0; j < vectors; j++) {
+                    ((Vector *) slot)[j] = n;
+                }
+                operands[top++] = slot;
+                continue;
+            }
+            if (op == OP_STORE || op == OP_LOAD) {
+                // Loads copy, as the slot may be reused while the value is
+                // still on the stack
+                double *temp = temps + (size_t) program->code[++i] * BLOCK_ROWS;
+                size_t size = sizeof(double) * vectors * VECTOR_LANES;
+                if (op == OP_STORE) {
+                    memcpy(temp, operands[top - 1], size);
+                } else {
+                    memcpy(slot, temp, size);
+                    operands[top++] = slot;
+                }
+                continue;
+            }
+            if (op == OP_VARIABLE) {
+                const double *column = columns[program->code[++i]] + first;
+                if (count == BLOCK_ROWS) {
+                    operands[top++] = column;
+                    continue;
+                }
+                memcpy(slot, column, sizeof(double) * count);
+                memset(
+                    slot + count, 0,
+                    sizeof(double) * (vectors * VECTOR_LANES - count)
+                );
+                operands[top++] = slot;
+                continue;
+            }
+
+            top--;
+            const Vector *a = (const Vector *) operands[top - 1];
+            const Vector *b = (const Vector *) operands[top];
+            double *value = slots + (size_t) (top - 1) * BLOCK_ROWS;
+            Vector *vector = (Vector *) value;
+            switch (op) {
+                case '+':
+                    for (int j = 0; j < vectors; j++) {
+                        vector[j] = a[j] + b[j];
+                    }
+                    break;
+                case '-':
+                    for (int j = 0; j < vectors; j++) {
+                        vector[j] = a[j] - b[j];
+                    }
+                    break;
+                case '*':
+                    for (int j = 0; j < vectors; j++) {
+                        vector[j] = a[j] * b[j];
+                    }
+                    break;
+                case '/':
+                    for (int j = 0; j < vectors; j++) {
+                        vector[j] = a[j] / b[j];
+                    }
+                    break;
+                default:
+                    for (int j = 0; j < vectors * VECTOR_LANES; j++) {
+                        value[j] = pow(
+                            operands[top - 1][j], operands[top][j]
+                        );
+                    }
+                    break;
+            }
+            operands[top - 1] = value;
+        }
+
+        memcpy(results + first, operands[top - 1], sizeof(double) * count);
+    }
+
+    free(temps);
+    free(slots);
+    free(operands);
+}
+
+// postfix -v: an expression, a line of column names, then a row of numbers
+// per line. Prints the expression's value for every row.
+int evaluate_columns(void) {
+    Input input;
+    input_init(&input);
+    Program program;
+    program_init(&program);
+
+    char *line = next_line(&input);
+    if (line == NULL || !compile(&program, line)) {
+        fprintf(stderr, "no expression to evaluate\n");
+        input_free(&input);
+        program_free(&program);
+        return 1;
+    }
+
+    char **names = NULL;
+    int num_columns = 0;
+    line = next_line(&input);
+    for (char *c = line; c != NULL && *c != '\n' && *c != '\0'; ) {
+        if (isspace(*c)) {
+            c++;
+            continue;
+        }
+
+        char *end = c;
+        while (*end != '\0' && !isspace(*end)) {
+            end++;
+        }
+        names = realloc(names, sizeof(char *) * (num_columns + 1));
+        names[num_columns++] = strndup(c, end - c);
+        c = end;
+    }
+
+    // Columns are kept in the order of the program's variables
+    int *column = malloc(sizeof(int) * (program.num_variables + 1));
+    int status = 0;
+    for (int i = 0; i < program.num_variables; i++) {
+        column[i] = -1;
+        for (int j = 0; j < num_columns; j++) {
+            if (strcmp(program.names[i], names[j]) == 0) {
+                column[i] = j;
+            }
+        }
+        if (column[i] < 0) {
+            fprintf(stderr, "no column named %s\n", program.names[i]);
+            status = 1;
+        }
+    }
+
+    double **columns = malloc(sizeof(double *) * (num_columns + 1));
+    int rows = 0, capacity = BLOCK_ROWS;
+    for (int j = 0; j < num_columns; j++) {
+        columns[j] = malloc(sizeof(double) * capacity);
+    }
+
+    while (status == 0 && (line = next_line(&input)) != NULL) {
+        if (rows == capacity) {
+            capacity *= 2;
+            for (int j = 0; j < num_columns; j++) {
+                columns[j] = realloc(columns[j], sizeof(double) * capacity);
+            }
+        }
+
+        char *c = line;
+        for (int j = 0; j < num_columns; j++) {
+            while (*c == ' ' || *c == '\t' || *c == '\r') {
+                c++;
+            }
+
+            double sign = 1;
+            if (*c == '-' || *c == '+') {
+                sign = *c++ == '-' ? -1 : 1;
+            }
+            columns[j][rows] = isdigit(*c) || *c == '.'
+                ? sign * scan_number(&c) : 0;
+        }
+        rows++;
+    }
+
+    if (status == 0) {
+        double **inputs = malloc(
+            sizeof(double *) * (program.num_variables + 1)
+        );
+        double *results = malloc(sizeof(double) * (rows > 0 ? rows : 1));
+        for (int i = 0; i < program.num_variables; i++) {
+            inputs[i] = columns[column[i]];
+        }
+
+        run_columns(&program, inputs, rows, results);
+        char *text = malloc(RESULT_LENGTH * BLOCK_ROWS), *end = text;
+        for (int i = 0; i < rows; i++) {
+            end = format_result(end, results[i]);
+            if (i % BLOCK_ROWS == BLOCK_ROWS - 1 || i == rows - 1) {
+                fwrite(text, 1, end - text, stdout);
+                end = text;
+            }
+        }
+
+        free(text);
+        free(results);
+        free(inputs);
+    }
+
+    for (int j = 0; j < num_columns; j++) {
+        free(columns[j]);
+        free(names[j]);
+    }
+    free(columns);
+    free(names);
+    free(column);
+    input_free(&input);
+    program_free(&program);
+    return status;
+}
+
+// Evaluate one expression per line, after the number of cases if the
+// first line holds just that. Each block read is split into chunks of
+// whole lines that the threads evaluate into chunk outputs, written in
+// order once the block is done.
+void evaluate_lines(int threads, Cache *cache) {
+    Input input;
+    input_init(&input);
+
+    char *line = next_line(&input);
+    if (line != NULL) {
+        char *end;
+        strtol(line, &end, 10);
+        while (*end == ' ' || *end == '\t' || *end == '\r') {
+            end++;
+        }
+        if (end == line || (*end != '\n' && *end != '\0')) {
+            input.position = line - input.buffer;
+        }
+    }
+
+    Batch batch;
+    batch.cache = cache;
+    batch.chunks = NULL;
+    batch.num_chunks = 0;
+    batch.capacity = 0;
+    batch.done = 0;
+    pthread_barrier_init(&batch.start, NULL, threads);
+    pthread_barrier_init(&batch.finish, NULL, threads);
+
+    pthread_t workers[threads];
+    for (int i = 1; i < threads; i++) {
+        pthread_create(&workers[i], NULL, batch_worker, &batch);
+    }
+
+    Program program;
+    program_init(&program);
+
+    size_t length;
+    char *block;
+    while ((block = next_lines(&input, &length)) != NULL) {
+        batch.num_chunks = 0;
+        for (char *c = block, *end = block + length; c < end; ) {
+            char *stop = NULL;
+            if (end - c > CHUNK_BYTES) {
+                stop = memchr(c + CHUNK_BYTES, '\n', end - c - CHUNK_BYTES);
+            }
+            stop = stop != NULL ? stop + 1 : end;
+
+            if (batch.num_chunks == batch.capacity) {
+                batch.capacity = batch.capacity > 0 ? 2 * batch.capacity : 16;
+                batch.chunks = realloc(
+                    batch.chunks, sizeof(Chunk) * batch.capacity
+                );
+                memset(
+                    batch.chunks + batch.num_chunks, 0,
+                    sizeof(Chunk) * (batch.capacity - batch.num_chunks)
+                );
+            }
+            batch.chunks[batch.num_chunks].start = c;
+            batch.chunks[batch.num_chunks].end = stop;
+            batch.num_chunks++;
+            c = stop;
+        }
+        atomic_store(&batch.next, 0);
+
+        pthread_barrier_wait(&batch.start);
+        batch_run(&batch, &program);
+        pthread_barrier_wait(&batch.finish);
+        if (cache != NULL) {
+            batch_record(&batch);
+        }
+
+        for (int i = 0; i < batch.num_chunks; i++) {
+            fwrite(batch.chunks[i].output, 1, batch.chunks[i].size, stdout);
+        }
+    }
+
+    batch.done = 1;
+    pthread_barrier_wait(&batch.start);
+    for (int i = 1; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+
+    for (int i = 0; i < batch.capacity; i++) {
+        free(batch.chunks[i].output);
+        free(batch.chunks[i].lines);
+        free(batch.chunks[i].misses);
+        free(batch.chunks[i].keys);
+        free(batch.chunks[i].seen);
+    }
+    free(batch.chunks);
+    pthread_barrier_destroy(&batch.start);
+    pthread_barrier_destroy(&batch.finish);
+    program_free(&program);
+    input_free(&input);
+}
+
+int evaluate(Program *program, char *line, double *result) {
+    return compile(program, line) && program->num_variables == 0
+        && run(program, NULL, result);
+}
+
+void batch_run(Batch *batch, Program *program) {
+    Cache *cache = batch->cache;
+    int i;
+    while ((i = atomic_fetch_add(&batch->next, 1)) < batch->num_chunks) {
+        Chunk *chunk = &batch->chunks[i];
+        chunk->size = 0;
+        chunk->num_lines = 0;
+        chunk->num_misses = 0;
+        chunk->keys_size = 0;
+        if (cache != NULL) {
+            if (chunk->seen == NULL) {
+                chunk->seen_capacity = 64;
+                chunk->seen = malloc(sizeof(int) * chunk->seen_capacity);
+            }
+            memset(chunk->seen, -1, sizeof(int) * chunk->seen_capacity);
+        }
+        for (char *line = chunk->start; line < chunk->end; ) {
+            char *next = memchr(line, '\n', chunk->end - line);
+            next = next != NULL ? next + 1 : chunk->end;
+
+            double result;
+            int ok;
+            if (cache == NULL) {
+                ok = evaluate(program, line, &result);
+            } else {
+                // A key takes at most a marker and a double per character
+                size_t most = (next - line + 1) * (1 + sizeof(double));
+                if (chunk->keys_capacity - chunk->keys_size < most) {
+                    chunk->keys_capacity = 2 * chunk->keys_capacity + most;
+                    chunk->keys = realloc(chunk->keys, chunk->keys_capacity);
+                }
+                if (chunk->num_lines == chunk->lines_capacity) {
+                    chunk->lines_capacity = 2 * chunk->lines_capacity + 64;
+                    chunk->lines = realloc(
+                        chunk->lines, sizeof(int) * chunk->lines_capacity
+                    );
+                }
+
+                char *key = chunk->keys + chunk->keys_size;
+                int length = normalize(line, key);
+                uint64_t hash = fnv1a(key, length);
+                int e = cache_find(cache, key, length, hash), m;
+                if (e >= 0) {
+                    result = cache->entries[e].result;
+                    ok = cache->entries[e].ok;
+                    chunk->lines[chunk->num_lines++] = e;
+                } else if ((m = chunk_find(chunk, key, length, hash)) >= 0) {
+                    result = chunk->misses[m].result;
+                    ok = chunk->misses[m].ok;
+                    chunk->lines[chunk->num_lines++] = -1 - m;
+                } else {
+                    ok = evaluate(program, line, &result);
+                    if (chunk->num_misses == chunk->misses_capacity) {
+                        chunk->misses_capacity =
+                            2 * chunk->misses_capacity + 64;
+                        chunk->misses = realloc(
+                            chunk->misses,
+                            sizeof(Miss) * chunk->misses_capacity
+                        );
+                    }
+                    Miss *miss = &chunk->misses[chunk->num_misses];
+                    miss->key = chunk->keys_size;
+                    miss->length = length;
+                    miss->hash = hash;
+                    miss->result = result;
+                    miss->ok = ok;
+                    chunk->keys_size += length;
+                    chunk->lines[chunk->num_lines++] = -1 - chunk->num_misses;
+                    chunk_remember(chunk, chunk->num_misses++);
+                }
+            }
+
+            if (ok) {
+                if (chunk->capacity - chunk->size < RESULT_LENGTH) {
+                    chunk->capacity = 2 * chunk->capacity + RESULT_LENGTH;
+                    chunk->output = realloc(chunk->output, chunk->capacity);
+                }
+                char *end = format_result(chunk->output + chunk->size, result);
+                chunk->size = end - chunk->output;
+            }
+            line = next;
+        }
+    }
+}
+
+// Bring the cache up to date with a block once the threads are done: the
+// entries found are used first, in order, so none of them is evicted by
+// the misses added after. Only the first time a line is seen counts as a
+// miss: repeats within a chunk share its miss, and a miss an earlier chunk
+// already added is a hit.
+void batch_record(Batch *batch) {
+    Cache *cache = batch->cache;
+    for (int i = 0; i < batch->num_chunks; i++) {
+        Chunk *chunk = &batch->chunks[i];
+        for (int j = 0; j < chunk->num_lines; j++) {
+            if (chunk->lines[j] >= 0) {
+                cache_use(cache, chunk->lines[j]);
+            }
+        }
+        cache->hits += chunk->num_lines - chunk->num_misses;
+    }
+
+    for (int i = 0; i < batch->num_chunks; i++) {
+        Chunk *chunk = &batch->chunks[i];
+        for (int j = 0; j < chunk->num_misses; j++) {
+            Miss *miss = &chunk->misses[j];
+            if (
+                cache_add(
+                    cache, chunk->keys + miss->key, miss->length, miss->hash,
+                    miss->result, miss->ok
+                )
+            ) {
+                cache->misses++;
+            } else {
+                cache->hits++;
+            }
+        }
+    }
+}
+
+// The miss of chunk with the given key, or -1
+int chunk_find(const Chunk *chunk, const char *key, int length, uint64_t hash) {
+    int mask = chunk->seen_capacity - 1, m;
+    for (int i = hash & mask; (m = chunk->seen[i]) >= 0; i = (i + 1) & mask) {
+        const Miss *miss = &chunk->misses[m];
+        if (
+            miss->hash == hash && miss->length == length
+            && memcmp(chunk->keys + miss->key, key, length) == 0
+        ) {
+            return m;
+        }
+    }
+    return -1;
+}
+
+// Add miss m to seen, keeping it at most half full
+void chunk_remember(Chunk *chunk, int m) {
+    if (2 * (m + 1) > chunk->seen_capacity) {
+        chunk->seen_capacity *= 2;
+        chunk->seen = realloc(chunk->seen, sizeof(int) * chunk->seen_capacity);
+        memset(chunk->seen, -1, sizeof(int) * chunk->seen_capacity);
+        for (int j = 0; j < m; j++) {
+            chunk_remember(chunk, j);
+        }
+    }
+
+    int mask = chunk->seen_capacity - 1;
+    int i = chunk->misses[m].hash & mask;
+    while (chunk->seen[i] >= 0) {
+        i = (i + 1) & mask;
+    }
+    chunk->seen[i] = m;
+}
+
+void *batch_worker(void *arg) {
+    Batch *batch = arg;
+    Program program;
+    program_init(&program);
+
+    while (1) {
+        pthread_barrier_wait(&batch->start);
+        if (batch->done) {
+            break;
+        }
+        batch_run(batch, &program);
+        pthread_barrier_wait(&batch->finish);
+    }
+
+    program_free(&program);
+    return NULL;
+}
+
+// Write x followed by a newline as printf("%.4f\n") would, returning the
+// end. Below 10^15, x times 10^4 is rounded half to even from the exact
+// binary value in 128 bits; anything bigger, infinite or NaN goes to
+// snprintf.
+char *format_result(char *out, double x) {
+    if (!(fabs(x) < 1e15)) {
+        return out + snprintf(out, RESULT_LENGTH, "%.4f\n", x);
+    }
+
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    int exponent = (int) (bits >> 52 & 0x7FF);
+    uint64_t mantissa = bits & ((UINT64_C(1) << 52) - 1);
+    int shift = 1074;
+    if (exponent != 0) {
+        mantissa |= UINT64_C(1) << 52;
+        shift = 1075 - exponent;
+    }
+
+    // x is mantissa / 2^shift with shift at least 3, so x times 10^4 fits
+    // 67 bits and is under a half once shifted further
+    uint64_t fixed = 0;
+    if (shift <= 67) {
+        unsigned __int128 scaled = (unsigned __int128) mantissa * 10000;
+        unsigned __int128 half = (unsigned __int128) 1 << (shift - 1);
+        unsigned __int128 rest = scaled & (2 * half - 1);
+        fixed = (uint64_t) (scaled >> shift);
+        if (rest > half || (rest == half && (fixed & 1))) {
+            fixed++;
+        }
+    }
+
+    char digits[24], *d = digits + sizeof(digits);
+    uint64_t whole = fixed / 10000;
+    unsigned fraction = (unsigned) (fixed % 10000);
+    *--d = '\n';
+    for (int i = 0; i < 4; i++) {
+        *--d = (char) ('0' + fraction % 10);
+        fraction /= 10;
+    }
+    *--d = '.';
+    do {
+        *--d = (char) ('0' + whole % 10);
+        whole /= 10;
+    } while (whole > 0);
+    if (bits >> 63) {
+        *--d = '-';
+    }
+
+    size_t length = digits + sizeof(digits) - d;
+    memcpy(out, d, length);
+    return out + length;
+}
+
+// Write the cache key of line to key and return its length: the
+// characters compile reads, with numbers as '#' and the bits of their
+// value, and a space kept where one separated a name from what follows
+int normalize(char *line, char *key) {
+    int length = 0, name = 0, gap = 0;
+    for (char *c = line; *c != '\0' && *c != '\n'; ) {
+        if (isdigit(*c) || *c == '.') {
+            if (name && gap) {
+                key[length++] = ' ';
+            }
+            double value = scan_number(&c);
+            key[length++] = '#';
+            memcpy(key + length, &value, sizeof(value));
+            length += sizeof(value);
+            name = 0;
+        } else if (isalpha(*c) || *c == '_') {
+            if (name && gap) {
+                key[length++] = ' ';
+            }
+            while (isalnum(*c) || *c == '_') {
+                key[length++] = *c++;
+            }
+            name = 1;
+        } else if (strchr("()+-*/^", *c) != NULL) {
+            key[length++] = *c++;
+            name = 0;
+        } else {
+            c++;
+            gap = 1;
+            continue;
+        }
+        gap = 0;
+    }
+    return length;
+}
+
+uint64_t fnv1a(const char *key, int length) {
+    uint64_t hash = UINT64_C(0xcbf29ce484222325);
+    for (int i = 0; i < length; i++) {
+        hash = (hash ^ (unsigned char) key[i]) * UINT64_C(0x100000001b3);
+    }
+    return hash;
+}
+
+void cache_init(Cache *cache, int capacity) {
+    int buckets = 1;
+    while (buckets < 2 * capacity) {
+        buckets *= 2;
+    }
+    cache->entries = malloc(sizeof(Entry) * capacity);
+    cache->size = 0;
+    cache->capacity = capacity;
+    cache->buckets = malloc(sizeof(int) * buckets);
+    memset(cache->buckets, -1, sizeof(int) * buckets);
+    cache->mask = buckets - 1;
+    cache->newest = -1;
+    cache->oldest = -1;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+void cache_free(Cache *cache) {
+    for (int i = 0; i < cache->size; i++) {
+        free(cache->entries[i].key);
+    }
+    free(cache->entries);
+    free(cache->buckets);
+}
+
+int cache_find(const Cache *cache, const char *key, int length, uint64_t hash) {
+    int e = cache->buckets[hash & cache->mask];
+    for (; e >= 0; e = cache->entries[e].next) {
+        const Entry *entry = &cache->entries[e];
+        if (
+            entry->hash == hash && entry->length == length
+            && memcmp(entry->key, key, length) == 0
+        ) {
+            return e;
+        }
+    }
+    return -1;
+}
+
+// Move entry e to the newest end of the order of use
+void cache_use(Cache *cache, int e) {
+    Entry *entries = cache->entries;
+    if (cache->newest == e) {
+        return;
+    }
+
+    if (entries[e].older >= 0) {
+        entries[entries[e].older].newer = entries[e].newer;
+    } else {
+        cache->oldest = entries[e].newer;
+    }
+    entries[entries[e].newer].older = entries[e].older;
+
+    entries[e].older = cache->newest;
+    entries[e].newer = -1;
+    entries[cache->newest].newer = e;
+    cache->newest = e;
+}
+
+// Add a result unless the key is there already, which is only used;
+// return whether it was added
+int cache_add(
+    Cache *cache, const char *key, int length, uint64_t hash, double result,
+    int ok
+) {
+    Entry *entries = cache->entries;
+    int e = cache_find(cache, key, length, hash);
+    if (e >= 0) {
+        cache_use(cache, e);
+        return 0;
+    }
+
+    if (cache->size < cache->capacity) {
+        e = cache->size++;
+    } else {
+        // Evict the least recently used entry and take its place
+        e = cache->oldest;
+        int *link = &cache->buckets[entries[e].hash & cache->mask];
+        while (*link != e) {
+            link = &entries[*link].next;
+        }
+        *link = entries[e].next;
+
+        cache->oldest = entries[e].newer;
+        if (cache->oldest >= 0) {
+            entries[cache->oldest].older = -1;
+        } else {
+            cache->newest = -1;
+        }
+        free(entries[e].key);
+    }
+
+    Entry *entry = &entries[e];
+    entry->key = malloc(length > 0 ? length : 1);
+    memcpy(entry->key, key, length);
+    entry->length = length;
+    entry->hash = hash;
+    entry->result = result;
+    entry->ok = ok;
+    entry->next = cache->buckets[hash & cache->mask];
+    cache->buckets[hash & cache->mask] = e;
+
+    entry->older = cache->newest;
+    entry->newer = -1;
+    if (cache->newest >= 0) {
+        entries[cache->newest].newer = e;
+    } else {
+        cache->oldest = e;
+    }
+    cache->newest = e;
+    return 1;
+}
+
+// The cache file holds CACHE_MAGIC, the number of entries, then for each,
+// oldest first, the key length, key, result and whether there was one
+int cache_load(Cache *cache, const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    char magic[4];
+    int32_t count = 0;
+    if (
+        fread(magic, 1, 4, file) != 4 || memcmp(magic, CACHE_MAGIC, 4) != 0
+        || fread(&count, sizeof(count), 1, file) != 1
+    ) {
+        fprintf(stderr, "%s is not a cache file\n", path);
+        fclose(file);
+        return 0;
+    }
+
+    char *key = NULL;
+    int32_t capacity = 0;
+    for (int32_t i = 0; i < count; i++) {
+        int32_t length, ok;
+        double result;
+        if (fread(&length, sizeof(length), 1, file) != 1 || length < 0) {
+            break;
+        }
+        if (length > capacity) {
+            capacity = length;
+            key = realloc(key, capacity);
+        }
+        if (
+            fread(key, 1, length, file) != (size_t) length
+            || fread(&result, sizeof(result), 1, file) != 1
+            || fread(&ok, sizeof(ok), 1, file) != 1
+        ) {
+            break;
+        }
+        cache_add(cache, key, length, fnv1a(key, length), result, ok);
+    }
+
+    free(key);
+    fclose(file);
+    return 1;
+}
+
+int cache_save(const Cache *cache, const char *path) {
+    FILE *file = fopen(path, "wb");
+    if (file == NULL) {
+        return 0;
+    }
+
+    int32_t count = cache->size;
+    fwrite(CACHE_MAGIC, 1, 4, file);
+    fwrite(&count, sizeof(count), 1, file);
+    for (int e = cache->oldest; e >= 0; e = cache->entries[e].newer) {
+        const Entry *entry = &cache->entries[e];
+        int32_t length = entry->length, ok = entry->ok;
+        fwrite(&length, sizeof(length), 1, file);
+        fwrite(entry->key, 1, length, file);
+        fwrite(&entry->result, sizeof(entry->result), 1, file);
+        fwrite(&ok, sizeof(ok), 1, file);
+    }
+    return fclose(file) == 0;
+}
+
+const double powers_of_ten[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11, 1e12,
+    1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+// 5^q for q from SMALLEST_POWER_OF_FIVE to LARGEST_POWER_OF_FIVE, scaled to
+// 128 bits with the top one set: truncated for q >= 0, and rounded up for
+// q < 0 so a product is never too small
+const uint64_t powers_of_five[][2] = {
+    { 0xa87fea27a539e9a5ULL, 0x3f2398d747b36224ULL },
+    { 0xd29fe4b18e88640eULL, 0x8eec7f0d19a03aadULL },
+    { 0x83a3eeeef9153e89ULL, 0x1953cf68300424acULL },
+    { 0xa48ceaaab75a8e2bULL, 0x5fa8c3423c052dd7ULL },
+    { 0xcdb02555653131b6ULL, 0x3792f412cb06794dULL },
+    { 0x808e17555f3ebf11ULL, 0xe2bbd88bbee40bd0ULL },
+    { 0xa0b19d2ab70e6ed6ULL, 0x5b6aceaeae9d0ec4ULL },
+    { 0xc8de047564d20a8bULL, 0xf245825a5a445275ULL },
+    { 0xfb158592be068d2eULL, 0xeed6e2f0f0d56712ULL },
+    { 0x9ced737bb6c4183dULL, 0x55464dd69685606bULL },
+    { 0xc428d05aa4751e4cULL, 0xaa97e14c3c26b886ULL },
+    { 0xf53304714d9265dfULL, 0xd53dd99f4b3066a8ULL },
+    { 0x993fe2c6d07b7fabULL, 0xe546a8038efe4029ULL },
+    { 0xbf8fdb78849a5f96ULL, 0xde98520472bdd033ULL },
+    { 0xef73d256a5c0f77cULL, 0x963e66858f6d4440ULL },
+    { 0x95a8637627989aadULL, 0xdde7001379a44aa8ULL },
+    { 0xbb127c53b17ec159ULL, 0x5560c018580d5d52ULL },
+    { 0xe9d71b689dde71afULL, 0xaab8f01e6e10b4a6ULL },
+    { 0x9226712162ab070dULL, 0xcab3961304ca70e8ULL },
+    { 0xb6b00d69bb55c8d1ULL, 0x3d607b97c5fd0d22ULL },
+    { 0xe45c10c42a2b3b05ULL, 0x8cb89a7db77c506aULL },
+    { 0x8eb98a7a9a5b04e3ULL, 0x77f3608e92adb242ULL },
+    { 0xb267ed1940f1c61cULL, 0x55f038b237591ed3ULL },
+    { 0xdf01e85f912e37a3ULL, 0x6b6c46dec52f6688ULL },
+    { 0x8b61313bbabce2c6ULL, 0x2323ac4b3b3da015ULL },
+    { 0xae397d8aa96c1b77ULL, 0xabec975e0a0d081aULL },
+    { 0xd9c7dced53c72255ULL, 0x96e7bd358c904a21ULL },
+    { 0x881cea14545c7575ULL, 0x7e50d64177da2e54ULL },
+    { 0xaa242499697392d2ULL, 0xdde50bd1d5d0b9e9ULL },
+    { 0xd4ad2dbfc3d07787ULL, 0x955e4ec64b44e864ULL },
+    { 0x84ec3c97da624ab4ULL, 0xbd5af13bef0b113eULL },
+    { 0xa6274bbdd0fadd61ULL, 0xecb1ad8aeacdd58eULL },
+    { 0xcfb11ead453994baULL, 0x67de18eda5814af2ULL },
+    { 0x81ceb32c4b43fcf4ULL, 0x80eacf948770ced7ULL },
+    { 0xa2425ff75e14fc31ULL, 0xa1258379a94d028dULL },
+    { 0xcad2f7f5359a3b3eULL, 0x096ee45813a04330ULL },
+    { 0xfd87b5f28300ca0dULL, 0x8bca9d6e188853fcULL },
+    { 0x9e74d1b791e07e48ULL, 0x775ea264cf55347eULL },
+    { 0xc612062576589ddaULL, 0x95364afe032a819eULL },
+    { 0xf79687aed3eec551ULL, 0x3a83ddbd83f52205ULL },
+    { 0x9abe14cd44753b52ULL, 0xc4926a9672793543ULL },
+    { 0xc16d9a0095928a27ULL, 0x75b7053c0f178294ULL },
+    { 0xf1c90080baf72cb1ULL, 0x5324c68b12dd6339ULL },
+    { 0x971da05074da7beeULL, 0xd3f6fc16ebca5e04ULL },
+    { 0xbce5086492111aeaULL, 0x88f4bb1ca6bcf585ULL },
+    { 0xec1e4a7db69561a5ULL, 0x2b31e9e3d06c32e6ULL },
+    { 0x9392ee8e921d5d07ULL, 0x3aff322e62439fd0ULL },
+    { 0xb877aa3236a4b449ULL, 0x09befeb9fad487c3ULL },
+    { 0xe69594bec44de15bULL, 0x4c2ebe687989a9b4ULL },
+    { 0x901d7cf73ab0acd9ULL, 0x0f9d37014bf60a11ULL },
+    { 0xb424dc35095cd80fULL, 0x538484c19ef38c95ULL },
+    { 0xe12e13424bb40e13ULL, 0x2865a5f206b06fbaULL },
+    { 0x8cbccc096f5088cbULL, 0xf93f87b7442e45d4ULL },
+    { 0xafebff0bcb24aafeULL, 0xf78f69a51539d749ULL },
+    { 0xdbe6fecebdedd5beULL, 0xb573440e5a884d1cULL },
+    { 0x89705f4136b4a597ULL, 0x31680a88f8953031ULL },
+    { 0xabcc77118461cefcULL, 0xfdc20d2b36ba7c3eULL },
+    { 0xd6bf94d5e57a42bcULL, 0x3d32907604691b4dULL },
+    { 0x8637bd05af6c69b5ULL, 0xa63f9a49c2c1b110ULL },
+    { 0xa7c5ac471b478423ULL, 0x0fcf80dc33721d54ULL },
+    { 0xd1b71758e219652bULL, 0xd3c36113404ea4a9ULL },
+    { 0x83126e978d4fdf3bULL, 0x645a1cac083126eaULL },
+    { 0xa3d70a3d70a3d70aULL, 0x3d70a3d70a3d70a4ULL },
+    { 0xccccccccccccccccULL, 0xcccccccccccccccdULL },
+    { 0x8000000000000000ULL, 0x0000000000000000ULL },
+    { 0xa000000000000000ULL, 0x0000000000000000ULL },
+    { 0xc800000000000000ULL, 0x0000000000000000ULL },
+    { 0xfa00000000000000ULL, 0x0000000000000000ULL },
+    { 0x9c40000000000000ULL, 0x0000000000000000ULL },
+    { 0xc350000000000000ULL, 0x0000000000000000ULL },
+    { 0xf424000000000000ULL, 0x0000000000000000ULL },
+    { 0x9896800000000000ULL, 0x0000000000000000ULL },
+    { 0xbebc200000000000ULL, 0x0000000000000000ULL },
+    { 0xee6b280000000000ULL, 0x0000000000000000ULL },
+    { 0x9502f90000000000ULL, 0x0000000000000000ULL },
+    { 0xba43b74000000000ULL, 0x0000000000000000ULL },
+    { 0xe8d4a51000000000ULL, 0x0000000000000000ULL },
+    { 0x9184e72a00000000ULL, 0x0000000000000000ULL },
+    { 0xb5e620f480000000ULL, 0x0000000000000000ULL },
+    { 0xe35fa931a0000000ULL, 0x0000000000000000ULL },
+    { 0x8e1bc9bf04000000ULL, 0x0000000000000000ULL },
+    { 0xb1a2bc2ec5000000ULL, 0x0000000000000000ULL },
+    { 0xde0b6b3a76400000ULL, 0x0000000000000000ULL },
+    { 0x8ac7230489e80000ULL, 0x0000000000000000ULL },
+    { 0xad78ebc5ac620000ULL, 0x0000000000000000ULL },
+    { 0xd8d726b7177a8000ULL, 0x0000000000000000ULL },
+    { 0x878678326eac9000ULL, 0x0000000000000000ULL },
+    { 0xa968163f0a57b400ULL, 0x0000000000000000ULL },
+    { 0xd3c21bcecceda100ULL, 0x0000000000000000ULL },
+    { 0x84595161401484a0ULL, 0x0000000000000000ULL },
+    { 0xa56fa5b99019a5c8ULL, 0x0000000000000000ULL },
+    { 0xcecb8f27f4200f3aULL, 0x0000000000000000ULL },
+    { 0x813f3978f8940984ULL, 0x4000000000000000ULL },
+    { 0xa18f07d736b90be5ULL, 0x5000000000000000ULL },
+    { 0xc9f2c9cd04674edeULL, 0xa400000000000000ULL },
+    { 0xfc6f7c4045812296ULL, 0x4d00000000000000ULL },
+    { 0x9dc5ada82b70b59dULL, 0xf020000000000000ULL },
+    { 0xc5371912364ce305ULL, 0x6c28000000000000ULL },
+    { 0xf684df56c3e01bc6ULL, 0xc732000000000000ULL },
+    { 0x9a130b963a6c115cULL, 0x3c7f400000000000ULL },
+    { 0xc097ce7bc90715b3ULL, 0x4b9f100000000000ULL },
+    { 0xf0bdc21abb48db20ULL, 0x1e86d40000000000ULL },
+    { 0x96769950b50d88f4ULL, 0x1314448000000000ULL },
+    { 0xbc143fa4e250eb31ULL, 0x17d955a000000000ULL },
+    { 0xeb194f8e1ae525fdULL, 0x5dcfab0800000000ULL },
+    { 0x92efd1b8d0cf37beULL, 0x5aa1cae500000000ULL },
+    { 0xb7abc627050305adULL, 0xf14a3d9e40000000ULL },
+    { 0xe596b7b0c643c719ULL, 0x6d9ccd05d0000000ULL },
+    { 0x8f7e32ce7bea5c6fULL, 0xe4820023a2000000ULL },
+    { 0xb35dbf821ae4f38bULL, 0xdda2802c8a800000ULL },
+    { 0xe0352f62a19e306eULL, 0xd50b2037ad200000ULL },
+    { 0x8c213d9da502de45ULL, 0x4526f422cc340000ULL },
+    { 0xaf298d050e4395d6ULL, 0x9670b12b7f410000ULL },
+    { 0xdaf3f04651d47b4cULL, 0x3c0cdd765f114000ULL },
+    { 0x88d8762bf324cd0fULL, 0xa5880a69fb6ac800ULL },
+    { 0xab0e93b6efee0053ULL, 0x8eea0d047a457a00ULL },
+    { 0xd5d238a4abe98068ULL, 0x72a4904598d6d880ULL },
+    { 0x85a36366eb71f041ULL, 0x47a6da2b7f864750ULL },
+    { 0xa70c3c40a64e6c51ULL, 0x999090b65f67d924ULL },
+    { 0xd0cf4b50cfe20765ULL, 0xfff4b4e3f741cf6dULL },
+    { 0x82818f1281ed449fULL, 0xbff8f10e7a8921a4ULL },
+    { 0xa321f2d7226895c7ULL, 0xaff72d52192b6a0dULL },
+    { 0xcbea6f8ceb02bb39ULL, 0x9bf4f8a69f764490ULL },
+    { 0xfee50b7025c36a08ULL, 0x02f236d04753d5b4ULL },
+    { 0x9f4f2726179a2245ULL, 0x01d762422c946590ULL },
+    { 0xc722f0ef9d80aad6ULL, 0x424d3ad2b7b97ef5ULL },
+    { 0xf8ebad2b84e0d58bULL, 0xd2e0898765a7deb2ULL },
+    { 0x9b934c3b330c8577ULL, 0x63cc55f49f88eb2fULL },
+    { 0xc2781f49ffcfa6d5ULL, 0x3cbf6b71c76b25fbULL },
+};
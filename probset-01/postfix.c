@@ -1,20 +1,53 @@
 #include <ctype.h>
 #include <limits.h>
 #include <math.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
-typedef struct OperatorNode {
-    char data;
-    struct OperatorNode *next;
-} OperatorNode;
+// Input is read and output written in blocks this big
+#define INPUT_BLOCK_SIZE (1 << 16)
+#define OUTPUT_BLOCK_SIZE (1 << 16)
+#define SEPARATOR "\n=======\n"
+// With -b, the postfix is written as BINARY_MAGIC and then records, each a
+// 32-bit little-endian length and that many bytes: RECORD_NAME and the
+// text of the next operand, numbered from 0, or RECORD_EXPRESSION and its
+// code for every input line. Code is operator characters, and OP_OPERAND
+// with a 32-bit little-endian operand number. An operand is defined before
+// the first expression that uses it.
+#define BINARY_MAGIC "RPN1"
+#define RECORD_NAME 'I'
+#define RECORD_EXPRESSION 'E'
+#define OP_OPERAND 'i'
 
+// Operators kept in an array that only grows when full
 typedef struct OperatorStack {
     int n;
-    OperatorNode *head;
+    int capacity;
+    char *data;
 } OperatorStack;
 
+// Distinct operand texts back to back, the ith from start[i] to
+// start[i + 1], found through an open addressing table of numbers
+typedef struct Names {
+    char *text;
+    size_t size;
+    size_t text_capacity;
+    size_t *start;
+    int count;
+    int capacity;
+    int *slots;
+    int mask;
+} Names;
+
+// A growable run of bytes
+typedef struct Bytes {
+    char *data;
+    size_t size;
+    size_t capacity;
+} Bytes;
+
 void push(OperatorStack *, char);
 char pop(OperatorStack *);
 char peek(OperatorStack *);
@@ -23,42 +56,114 @@ void empty(OperatorStack *);
 int icp(char);
 int isp(char);
 
+void output(const char *, size_t);
+void output_char(char);
+void output_token(char);
+void output_record(char, const char *, size_t);
+void flush(void);
+
+void emit_operand(char, int);
+void end_operand(void);
+void emit_operator(char);
+void end_line(void);
+
+void append(Bytes *, const char *, size_t);
+int intern(Names *, const char *, size_t);
+uint32_t hash(const char *, size_t);
+
+char output_buffer[OUTPUT_BLOCK_SIZE];
+size_t output_size = 0;
+// With -s tokens are set apart by spaces, so operands of more than one
+// character stay apart; output_started tells whether the line has one yet
+int separated = 0;
+int output_started = 0;
+
+int binary = 0;
+Names names;
+// The operand being read and the code of the line, in binary
+Bytes token, code;
+
 int main(int argc, char *argv[]) {
-    char c;
-    OperatorStack *operators = malloc(sizeof(OperatorStack));
-    operators->head = NULL;
-    operators->n = 0;
-
-    while ((c = getchar()) != EOF) {
-        if (operators->head == NULL) {
-            push(operators, '(');
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-s") == 0) {
+            separated = 1;
+        } else if (strcmp(argv[i], "-b") == 0) {
+            binary = 1;
         }
-        if (strchr("+-*/^()\n", c) != NULL) {
-            char o;
+    }
+
+    if (binary) {
+        names.capacity = 64;
+        names.start = malloc(sizeof(size_t) * (names.capacity + 1));
+        names.start[0] = 0;
+        names.slots = malloc(sizeof(int) * 2 * names.capacity);
+        memset(names.slots, -1, sizeof(int) * 2 * names.capacity);
+        names.mask = 2 * names.capacity - 1;
+        output(BINARY_MAGIC, 4);
+    }
+
+    static char input[INPUT_BLOCK_SIZE];
+    OperatorStack operators = { 0, 64, malloc(64) };
+    // Whether the last character was part of an identifier or number
+    int operand = 0;
+    size_t read;
+
+    while ((read = fread(input, 1, sizeof(input), stdin)) > 0) {
+        for (size_t i = 0; i < read; i++) {
+            char c = input[i], o;
+            if (operators.n == 0) {
+                push(&operators, '(');
+            }
+
+            if (isalnum(c)) {
+                emit_operand(c, !operand);
+                operand = 1;
+                continue;
+            }
+            if (operand) {
+                end_operand();
+            }
+            operand = 0;
+
             if (c == '(') {
-                push(operators, c);
+                push(&operators, c);
             } else if (c == ')' || c == '\n') {
-                while ((o = pop(operators)) != '(') {
-                    printf("%c", o);
+                while ((o = pop(&operators)) != '(') {
+                    emit_operator(o);
                 }
-            } else {
-                while (icp(c) < isp(peek(operators))) {
-                    o = pop(operators);
-                    printf("%c", o);
+            } else if (c != '\0' && strchr("+-*/^", c) != NULL) {
+                while (icp(c) < isp(peek(&operators))) {
+                    emit_operator(pop(&operators));
                 }
-                push(operators, c);
+                push(&operators, c);
             }
+
             if (c == '\n') {
-                empty(operators);
-                printf("%c=======\n", c);
+                empty(&operators);
+                end_line();
             }
-        } else if (isalnum(c)) {
-            printf("%c", c);
         }
     }
 
-    empty(operators);
-    free(operators);
+    // A last line without a newline still ends its expression
+    if (operand) {
+        end_operand();
+    }
+    if (output_started) {
+        char o;
+        while ((o = pop(&operators)) != '(' && o != EOF) {
+            emit_operator(o);
+        }
+        end_line();
+    }
+
+    flush();
+    free(operators.data);
+    free(names.text);
+    free(names.start);
+    free(names.slots);
+    free(token.data);
+    free(code.data);
 
     // We cool? We cool.
     return 0;
@@ -97,39 +202,197 @@ int isp(char operator) {
 }
 
 void push(OperatorStack *stack, char c) {
-    OperatorNode *node = malloc(sizeof(OperatorNode));
+    if (stack->n == stack->capacity) {
+        stack->capacity *= 2;
+        stack->data = realloc(stack->data, stack->capacity);
+    }
 
-    node->data = c;
-    node->next = stack->head;
-    stack->n++;
-    printf("{%d}\n", stack->n);
-    stack->head = node;
+    stack->data[stack->n++] = c;
+    #if DEBUG
+        // Kept out of the binary stream
+        if (binary) {
+            fprintf(stderr, "{%d}\n", stack->n);
+        } else {
+            char depth[16];
+            output(depth, sprintf(depth, "{%d}\n", stack->n));
+        }
+    #endif
 }
 
 char pop(OperatorStack *stack) {
-    char c;
-    if (stack->head == NULL) {
+    if (stack->n == 0) {
         return EOF;
     }
-    
-    OperatorNode *tmp = stack->head;
-    stack->head = stack->head->next;
-    stack->n--;
-    c = tmp->data;
-    free(tmp);
-    return c;
+
+    return stack->data[--stack->n];
 }
 
 char peek(OperatorStack *stack) {
-    if (stack->head == NULL) {
+    if (stack->n == 0) {
         return EOF;
     }
 
-    return stack->head->data;
+    return stack->data[stack->n - 1];
 }
 
 void empty(OperatorStack *stack) {
-    while (stack->head != NULL) {
-        pop(stack);
+    stack->n = 0;
+}
+
+void output(const char *text, size_t length) {
+    if (OUTPUT_BLOCK_SIZE - output_size < length) {
+        flush();
+    }
+    if (length >= OUTPUT_BLOCK_SIZE) {
+        fwrite(text, 1, length, stdout);
+        return;
+    }
+
+    memcpy(output_buffer + output_size, text, length);
+    output_size += length;
+}
+
+void output_char(char c) {
+    if (output_size == OUTPUT_BLOCK_SIZE) {
+        flush();
+    }
+    output_buffer[output_size++] = c;
+}
+
+// Start a token: an operator or the first character of an operand, after
+// a space with -s unless it is the first on its line
+void output_token(char c) {
+    if (separated && output_started) {
+        output_char(' ');
+    }
+    output_char(c);
+    output_started = 1;
+}
+
+// Write a record: its length, type and then data
+void output_record(char type, const char *data, size_t length) {
+    uint32_t size = (uint32_t) length + 1;
+    char header[5] = {
+        (char) size, (char) (size >> 8), (char) (size >> 16),
+        (char) (size >> 24), type
+    };
+    output(header, 5);
+    output(data, length);
+}
+
+void flush(void) {
+    fwrite(output_buffer, 1, output_size, stdout);
+    output_size = 0;
+}
+
+// Take the next character of an operand, first if it starts one
+void emit_operand(char c, int first) {
+    if (binary) {
+        if (first) {
+            token.size = 0;
+        }
+        append(&token, &c, 1);
+    } else if (first) {
+        output_token(c);
+    } else {
+        output_char(c);
+    }
+}
+
+void end_operand(void) {
+    if (!binary) {
+        return;
+    }
+
+    uint32_t i = intern(&names, token.data, token.size);
+    char operand[5] = {
+        OP_OPERAND, (char) i, (char) (i >> 8), (char) (i >> 16),
+        (char) (i >> 24)
+    };
+    append(&code, operand, 5);
+    output_started = 1;
+}
+
+void emit_operator(char o) {
+    if (binary) {
+        append(&code, &o, 1);
+        output_started = 1;
+    } else {
+        output_token(o);
+    }
+}
+
+void end_line(void) {
+    if (binary) {
+        output_record(RECORD_EXPRESSION, code.data, code.size);
+        code.size = 0;
+    } else {
+        output(SEPARATOR, sizeof(SEPARATOR) - 1);
+    }
+    output_started = 0;
+}
+
+void append(Bytes *bytes, const char *data, size_t length) {
+    if (bytes->capacity - bytes->size < length) {
+        bytes->capacity = 2 * bytes->capacity + length;
+        bytes->data = realloc(bytes->data, bytes->capacity);
+    }
+    memcpy(bytes->data + bytes->size, data, length);
+    bytes->size += length;
+}
+
+// The number of an operand, written out as a record the first time
+int intern(Names *names, const char *text, size_t length) {
+    int slot = hash(text, length) & names->mask;
+    for (int i; (i = names->slots[slot]) >= 0; ) {
+        size_t start = names->start[i];
+        if (
+            names->start[i + 1] - start == length
+            && memcmp(names->text + start, text, length) == 0
+        ) {
+            return i;
+        }
+        slot = (slot + 1) & names->mask;
+    }
+
+    int i = names->count++;
+    names->slots[slot] = i;
+    if (names->text_capacity - names->size < length) {
+        names->text_capacity = 2 * names->text_capacity + length;
+        names->text = realloc(names->text, names->text_capacity);
+    }
+    memcpy(names->text + names->size, text, length);
+    names->size += length;
+    names->start[names->count] = names->size;
+    output_record(RECORD_NAME, text, length);
+
+    // Keep the table at most half full
+    if (names->count == names->capacity) {
+        names->capacity *= 2;
+        names->start = realloc(
+            names->start, sizeof(size_t) * (names->capacity + 1)
+        );
+        names->mask = 2 * names->capacity - 1;
+        names->slots = realloc(names->slots, sizeof(int) * 2 * names->capacity);
+        memset(names->slots, -1, sizeof(int) * 2 * names->capacity);
+        for (int j = 0; j < names->count; j++) {
+            size_t start = names->start[j];
+            int s = hash(names->text + start, names->start[j + 1] - start)
+                & names->mask;
+            while (names->slots[s] >= 0) {
+                s = (s + 1) & names->mask;
+            }
+            names->slots[s] = j;
+        }
+    }
+    return i;
+}
+
+// FNV-1a
+uint32_t hash(const char *text, size_t length) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < length; i++) {
+        h = (h ^ (unsigned char) text[i]) * 16777619u;
     }
+    return h;
 }